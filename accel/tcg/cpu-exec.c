@@ -618,8 +618,19 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 {
     uintptr_t old;
 
-    qemu_thread_jit_write();
     assert(n < ARRAY_SIZE(tb->jmp_list_next));
+
+    /*
+     * The slot may already be claimed, either by another vCPU that
+     * chained the same edge concurrently or because @tb has been
+     * invalidated.  Avoid the lock and the jit write toggle then;
+     * the cmpxchg below remains authoritative.
+     */
+    if (qatomic_read(&tb->jmp_dest[n])) {
+        return;
+    }
+
+    qemu_thread_jit_write();
     qemu_spin_lock(&tb_next->jmp_lock);
 
     /* make sure the destination TB is valid */
@@ -969,7 +980,21 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                 uint32_t h;
 
                 mmap_lock();
+#ifdef CONFIG_USER_ONLY
+                /*
+                 * Translation is serialized by mmap_lock in user mode.
+                 * When many guest threads miss on the same new code, all
+                 * but the first would translate it again while holding
+                 * the lock, only to discard the result in tb_link_page.
+                 * Re-check the QHT now that we own the lock.
+                 */
+                tb = tb_htable_lookup(cpu, s);
+                if (tb == NULL) {
+                    tb = tb_gen_code(cpu, s);
+                }
+#else
                 tb = tb_gen_code(cpu, s);
+#endif
                 mmap_unlock();
 
                 /*
@@ -324,6 +324,7 @@ void tlb_init(CPUState *cpu)
     int i;
 
     qemu_spin_init(&cpu->neg.tlb.c.lock);
+    qemu_spin_init(&cpu->neg.tlb.c.pending_lock);
 
     /* All tlbs are initialized flushed. */
     cpu->neg.tlb.c.dirty = 0;
@@ -338,6 +339,7 @@ void tlb_destroy(CPUState *cpu)
     int i;
 
     qemu_spin_destroy(&cpu->neg.tlb.c.lock);
+    qemu_spin_destroy(&cpu->neg.tlb.c.pending_lock);
     for (i = 0; i < NB_MMU_MODES; i++) {
         CPUTLBDesc *desc = &cpu->neg.tlb.d[i];
         CPUTLBDescFast *fast = cpu_tlb_fast(cpu, i);
@@ -347,24 +349,8 @@ void tlb_destroy(CPUState *cpu)
     }
 }
 
-/* flush_all_helper: run fn across all cpus
- *
- * If the wait flag is set then the src cpu's helper will be queued as
- * "safe" work and the loop exited creating a synchronisation point
- * where all queued work will be finished before execution starts
- * again.
- */
-static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
-                             run_on_cpu_data d)
-{
-    CPUState *cpu;
-
-    CPU_FOREACH(cpu) {
-        if (cpu != src) {
-            async_run_on_cpu(cpu, fn, d);
-        }
-    }
-}
+static void tlb_queue_flush(CPUState *cpu, MMUIdxMap full,
+                            const TLBFlushRangeData *range);
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
@@ -424,9 +410,15 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, MMUIdxMap idxmap)
 {
     const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
 
+    CPUState *dst_cpu;
+
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_queue_flush(dst_cpu, idxmap, NULL);
+        }
+    }
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
@@ -499,6 +491,56 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
+/*
+ * Return the mask of the guest page that @full was filled from,
+ * which may be larger than TARGET_PAGE_SIZE.
+ */
+static inline vaddr tlb_full_page_mask(const CPUTLBEntryFull *full)
+{
+    if (full->lg_page_size > TARGET_PAGE_BITS) {
+        return (vaddr)-1 << full->lg_page_size;
+    }
+    return -1;
+}
+
+/* Called with tlb_c.lock held */
+static bool tlb_flush_entry_full_locked(CPUTLBEntry *tlb_entry,
+                                        const CPUTLBEntryFull *full,
+                                        vaddr page)
+{
+    return !tlb_entry_is_empty(tlb_entry) &&
+           tlb_flush_entry_mask_locked(tlb_entry, page,
+                                       tlb_full_page_mask(full));
+}
+
+/*
+ * Flush @page from a tlb that may contain large pages covering it.
+ * Each large page is entered into the tlb as many TARGET_PAGE_SIZE
+ * entries at unrelated indexes, so scan the whole table, using the
+ * page size recorded for each entry, rather than discarding the
+ * translations of every other page as well.
+ *
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_large_page_locked(CPUState *cpu, int midx, vaddr page)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    CPUTLBDescFast *f = cpu_tlb_fast(cpu, midx);
+    size_t i, n = tlb_n_entries(f);
+
+    for (i = 0; i < n; i++) {
+        if (tlb_flush_entry_full_locked(&f->table[i], &d->fulltlb[i], page)) {
+            tlb_n_used_entries_dec(cpu, midx);
+        }
+    }
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        if (tlb_flush_entry_full_locked(&d->vtable[i], &d->vfulltlb[i],
+                                        page)) {
+            tlb_n_used_entries_dec(cpu, midx);
+        }
+    }
+}
+
 static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 {
     vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
@@ -506,10 +548,10 @@ static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d (%016"
+        tlb_debug("scanning for large pages midx %d (%016"
                   VADDR_PRIx "/%016" VADDR_PRIx ")\n",
                   midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+        tlb_flush_large_page_locked(cpu, midx, page);
     } else {
         if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
             tlb_n_used_entries_dec(cpu, midx);
@@ -618,35 +660,36 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               MMUIdxMap idxmap)
 {
+    TLBFlushRangeData r;
+    CPUState *dst_cpu;
+
     tlb_debug("addr: %016" VADDR_PRIx " mmu_idx:%"PRIx16"\n", addr, idxmap);
 
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    /* A range of one page with all bits significant is a page flush. */
+    r.addr = addr;
+    r.len = TARGET_PAGE_SIZE;
+    r.idxmap = idxmap;
+    r.bits = target_long_bits();
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_queue_flush(dst_cpu, 0, &r);
+        }
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
      * See tlb_flush_page_by_mmuidx for details.
      */
     if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
         async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
                               RUN_ON_CPU_TARGET_PTR(addr | idxmap));
     } else {
-        CPUState *dst_cpu;
         TLBFlushPageByMMUIdxData *d;
 
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-
         d = g_new(TLBFlushPageByMMUIdxData, 1);
         d->addr = addr;
         d->idxmap = idxmap;
@@ -710,13 +753,6 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
     }
 }
 
-typedef struct {
-    vaddr addr;
-    vaddr len;
-    MMUIdxMap idxmap;
-    unsigned bits;
-} TLBFlushRangeData;
-
 static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
                                               TLBFlushRangeData d)
 {
@@ -763,6 +799,68 @@ static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
     g_free(d);
 }
 
+static void tlb_flush_pending_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_SIZE];
+    MMUIdxMap full;
+    unsigned i, n;
+
+    qemu_spin_lock(&c->pending_lock);
+    full = c->pending_full;
+    n = c->pending_n;
+    memcpy(pending, c->pending, n * sizeof(pending[0]));
+    c->pending_full = 0;
+    c->pending_n = 0;
+    qemu_spin_unlock(&c->pending_lock);
+
+    if (full) {
+        tlb_flush_by_mmuidx_async_work(cpu, RUN_ON_CPU_HOST_INT(full));
+    }
+    for (i = 0; i < n; i++) {
+        TLBFlushRangeData *d = &pending[i];
+
+        d->idxmap &= ~full;
+        if (!d->idxmap) {
+            continue;
+        }
+        if (d->len <= TARGET_PAGE_SIZE && d->bits >= target_long_bits()) {
+            tlb_flush_page_by_mmuidx_async_0(cpu, d->addr, d->idxmap);
+        } else {
+            tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+        }
+    }
+}
+
+/*
+ * Queue a flush on @cpu, which is not the current cpu: of @range if
+ * non-NULL, otherwise of all of the mmu_idx in @full.
+ *
+ * Requests made before @cpu gets around to processing them are merged
+ * into a single work item, so that a burst of broadcast invalidates
+ * from the guest costs one kick and one allocation-free work item per
+ * target cpu, rather than one of each per invalidate.
+ */
+static void tlb_queue_flush(CPUState *cpu, MMUIdxMap full,
+                            const TLBFlushRangeData *range)
+{
+    CPUTLBCommon *c = &cpu->neg.tlb.c;
+    bool first;
+
+    qemu_spin_lock(&c->pending_lock);
+    first = c->pending_n == 0 && c->pending_full == 0;
+    if (range && c->pending_n < CPU_TLB_PENDING_SIZE) {
+        c->pending[c->pending_n++] = *range;
+    } else {
+        c->pending_full |= range ? range->idxmap : full;
+    }
+    qemu_spin_unlock(&c->pending_lock);
+
+    if (first) {
+        async_run_on_cpu(cpu, tlb_flush_pending_async_work, RUN_ON_CPU_NULL);
+    }
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
                                vaddr len, MMUIdxMap idxmap,
                                unsigned bits)
@@ -829,12 +927,9 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
-    /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
-            p = g_memdup(&d, sizeof(d));
-            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
-                             RUN_ON_CPU_HOST_PTR(p));
+            tlb_queue_flush(dst_cpu, 0, &d);
         }
     }
 
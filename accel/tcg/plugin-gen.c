@@ -226,6 +226,126 @@ static void gen_inline_store_u64_cb(struct qemu_plugin_inline_cb *cb)
     tcg_temp_free_ptr(ptr);
 }
 
+static void gen_inline_minmax_u64_cb(struct qemu_plugin_inline_cb *cb,
+                                     bool is_max)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->entry);
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    TCGv_i64 imm = tcg_constant_i64(cb->imm);
+
+    tcg_gen_ld_i64(val, ptr, 0);
+    if (is_max) {
+        tcg_gen_umax_i64(val, val, imm);
+    } else {
+        tcg_gen_umin_i64(val, val, imm);
+    }
+    tcg_gen_st_i64(val, ptr, 0);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static TCGv_ptr gen_mem_trace_buf_ptr(struct qemu_plugin_mem_trace *trace)
+{
+    qemu_plugin_u64 entry = {
+        .score = trace->score,
+        .offset = offsetof(struct qemu_plugin_mem_trace_buf, len),
+    };
+
+    return gen_plugin_u64_ptr(entry);
+}
+
+/*
+ * At the start of an instruction, make room in the trace buffer for
+ * the @n_accesses memory accesses the instruction may record.
+ */
+static void gen_mem_trace_reserve(struct qemu_plugin_mem_trace_cb *cb,
+                                  unsigned n_accesses)
+{
+    static TCGHelperInfo info = {
+        .flags = TCG_CALL_NO_RWG,
+        /* Match plugin_mem_trace_flush: void (*)(uint32_t, void *) */
+        .typemask = (dh_typemask(void, 0) |
+                     dh_typemask(i32, 1) |
+                     dh_typemask(ptr, 2)),
+    };
+    struct qemu_plugin_mem_trace *trace = cb->trace;
+    uint64_t limit = trace->n_records - MIN(n_accesses, trace->n_records);
+    TCGv_ptr ptr = gen_mem_trace_buf_ptr(trace);
+    TCGv_i64 len = tcg_temp_ebb_new_i64();
+    TCGLabel *after_flush = gen_new_label();
+
+    tcg_gen_ld_i64(len, ptr, 0);
+    tcg_gen_brcondi_i64(TCG_COND_LEU, len, limit, after_flush);
+    TCGv_i32 cpu_index = gen_cpu_index();
+    tcg_gen_call2(plugin_mem_trace_flush, &info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_ptr_temp(tcg_constant_ptr(trace)));
+    tcg_temp_free_i32(cpu_index);
+    gen_set_label(after_flush);
+
+    tcg_temp_free_i64(len);
+    tcg_temp_free_ptr(ptr);
+}
+
+/*
+ * Append a record to the trace buffer.  This is emitted in the middle of
+ * the guest memory operation, where ebb temps may be live, so it must not
+ * branch: room was made by gen_mem_trace_reserve.  An instruction making
+ * more accesses than the buffer holds overwrites its last record.
+ */
+static void gen_mem_trace_record(struct qemu_plugin_mem_trace_cb *cb,
+                                 qemu_plugin_meminfo_t meminfo,
+                                 TCGv_i64 addr)
+{
+    struct qemu_plugin_mem_trace *trace = cb->trace;
+    intptr_t rec_ofs = offsetof(struct qemu_plugin_mem_trace_buf, records);
+    TCGv_ptr ptr = gen_mem_trace_buf_ptr(trace);
+    TCGv_ptr rec = tcg_temp_ebb_new_ptr();
+    TCGv_i64 len = tcg_temp_ebb_new_i64();
+    TCGv_i64 ofs = tcg_temp_ebb_new_i64();
+    TCGv_i64 val = tcg_temp_ebb_new_i64();
+    MemOp size = get_memop(meminfo) & MO_SIZE;
+
+    tcg_gen_ld_i64(len, ptr, 0);
+    tcg_gen_umin_i64(ofs, len, tcg_constant_i64(trace->n_records - 1));
+    tcg_gen_muli_i64(ofs, ofs, sizeof(qemu_plugin_mem_record));
+    tcg_gen_trunc_i64_ptr(rec, ofs);
+    tcg_gen_add_ptr(rec, rec, ptr);
+    tcg_gen_st_i64(addr, rec,
+                   rec_ofs + offsetof(qemu_plugin_mem_record, vaddr));
+    tcg_gen_st_i32(tcg_constant_i32(meminfo), rec,
+                   rec_ofs + offsetof(qemu_plugin_mem_record, info));
+
+    /* The memory operation left the value in CPUState, as for helpers */
+    tcg_gen_ld_i64(val, tcg_env,
+                   offsetof(CPUState, neg.plugin_mem_value_low) -
+                   sizeof(CPUState));
+    if (size < MO_64) {
+        /* Narrower accesses only update the low bytes */
+        tcg_gen_andi_i64(val, val, MAKE_64BIT_MASK(0, 8 << size));
+    }
+    tcg_gen_st_i64(val, rec,
+                   rec_ofs + offsetof(qemu_plugin_mem_record, value));
+    if (size == MO_128) {
+        tcg_gen_ld_i64(val, tcg_env,
+                       offsetof(CPUState, neg.plugin_mem_value_high) -
+                       sizeof(CPUState));
+        tcg_gen_st_i64(val, rec,
+                       rec_ofs + offsetof(qemu_plugin_mem_record, value_high));
+    }
+
+    tcg_gen_addi_i64(len, len, 1);
+    tcg_gen_umin_i64(len, len, tcg_constant_i64(trace->n_records));
+    tcg_gen_st_i64(len, ptr, 0);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_i64(ofs);
+    tcg_temp_free_i64(len);
+    tcg_temp_free_ptr(rec);
+    tcg_temp_free_ptr(ptr);
+}
+
 static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
                        qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
 {
@@ -264,6 +384,12 @@ static void inject_cb(struct qemu_plugin_dyn_cb *cb)
     case PLUGIN_CB_INLINE_STORE_U64:
         gen_inline_store_u64_cb(&cb->inline_insn);
         break;
+    case PLUGIN_CB_INLINE_MIN_U64:
+        gen_inline_minmax_u64_cb(&cb->inline_insn, false);
+        break;
+    case PLUGIN_CB_INLINE_MAX_U64:
+        gen_inline_minmax_u64_cb(&cb->inline_insn, true);
+        break;
     default:
         g_assert_not_reached();
     }
@@ -279,8 +405,15 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             gen_mem_cb(&cb->regular, meminfo, addr);
         }
         break;
+    case PLUGIN_CB_MEM_TRACE:
+        if (rw & cb->mem_trace.rw) {
+            gen_mem_trace_record(&cb->mem_trace, meminfo, addr);
+        }
+        break;
     case PLUGIN_CB_INLINE_ADD_U64:
     case PLUGIN_CB_INLINE_STORE_U64:
+    case PLUGIN_CB_INLINE_MIN_U64:
+    case PLUGIN_CB_INLINE_MAX_U64:
         if (rw & cb->inline_insn.rw) {
             inject_cb(cb);
         }
@@ -290,6 +423,18 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
     }
 }
 
+/* Count the memory accesses of the instruction starting after @op. */
+static unsigned count_insn_mem_accesses(TCGOp *op)
+{
+    unsigned n = 0;
+
+    while ((op = QTAILQ_NEXT(op, link)) != NULL &&
+           op->opc != INDEX_op_insn_start) {
+        n += op->opc == INDEX_op_plugin_mem_cb;
+    }
+    return n;
+}
+
 static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
 {
     TCGOp *op, *next;
@@ -366,6 +511,20 @@ static void plugin_gen_inject(struct qemu_plugin_tb *plugin_tb)
                     inject_cb(
                         &g_array_index(cbs, struct qemu_plugin_dyn_cb, i));
                 }
+
+                cbs = insn->mem_cbs;
+                for (i = 0, n = (cbs ? cbs->len : 0); i < n; i++) {
+                    struct qemu_plugin_dyn_cb *cb =
+                        &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+                    if (cb->type == PLUGIN_CB_MEM_TRACE) {
+                        unsigned n_accesses = count_insn_mem_accesses(op);
+
+                        if (n_accesses) {
+                            gen_mem_trace_reserve(&cb->mem_trace, n_accesses);
+                        }
+                    }
+                }
                 break;
 
             default:
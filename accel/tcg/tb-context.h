@@ -35,6 +35,9 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_gen_count;
+    unsigned tb_gen_restart_count;
+    unsigned tb_gen_discard_count;
 };
 
 extern TBContext tb_ctx;
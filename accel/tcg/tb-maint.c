@@ -1104,7 +1104,8 @@ bool tb_invalidate_phys_page_unwind(CPUState *cpu, tb_page_addr_t addr,
 #else
 /*
  * @p must be non-NULL.
- * Call with all @pages locked.
+ * Call with all @pages locked, or with only @p locked and @pages NULL
+ * if page_tbs_are_local(@p).
  * (@cpu, @retaddr) may be (NULL, 0) outside of a cpu context,
  * in which case precise_smc need not be detected.
  */
@@ -1166,7 +1167,11 @@ tb_invalidate_phys_page_range__locked(CPUState *cpu,
     }
 
     if (unlikely(current_tb_modified)) {
-        page_collection_unlock(pages);
+        if (pages) {
+            page_collection_unlock(pages);
+        } else {
+            page_unlock(p);
+        }
         /* Force execution of one insn next time.  */
         cpu->cflags_next_tb = 1 | CF_NOIRQ | curr_cflags(cpu);
         cpu_loop_exit_noexc(cpu);
@@ -1206,6 +1211,25 @@ void tb_invalidate_phys_range(CPUState *cpu, tb_page_addr_t start,
     page_collection_unlock(pages);
 }
 
+/*
+ * Return true if no TB on @pd extends onto another page, i.e. if the
+ * lock on @pd alone is enough to invalidate any of them.
+ * Call with @pd locked.
+ */
+static bool page_tbs_are_local(PageDesc *pd)
+{
+    TranslationBlock *tb;
+    PageForEachNext n;
+
+    assert_page_locked(pd);
+    PAGE_FOR_EACH_TB(unused, unused, pd, tb, n) {
+        if (tb_page_addr1(tb) != -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
  * len must be <= 8 and start must be a multiple of len.
  * Called via softmmu_template.h when code areas are written to with
@@ -1218,7 +1242,24 @@ void tb_invalidate_phys_range_fast(CPUState *cpu, ram_addr_t start,
 
     if (p) {
         ram_addr_t last = start + len - 1;
-        struct page_collection *pages = page_collection_lock(start, last);
+        struct page_collection *pages;
+
+        /*
+         * The access is within a single page.  Unless one of its TBs
+         * crosses into a neighbouring page, lock just this page rather
+         * than allocating and populating a page_collection, which is
+         * expensive for guests that write to code pages frequently.
+         */
+        page_lock(p);
+        if (page_tbs_are_local(p)) {
+            tb_invalidate_phys_page_range__locked(cpu, NULL, p,
+                                                  start, last, ra);
+            page_unlock(p);
+            return;
+        }
+        page_unlock(p);
+
+        pages = page_collection_lock(start, last);
 
         tb_invalidate_phys_page_range__locked(cpu, pages, p,
                                               start, last, ra);
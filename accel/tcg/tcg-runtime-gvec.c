@@ -21,6 +21,9 @@
 #include "qemu/host-utils.h"
 #include "exec/helper-proto-common.h"
 #include "tcg/tcg-gvec-desc.h"
+#ifdef CONFIG_AVX2_OPT
+#include "host/cpuinfo.h"
+#endif
 
 
 static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
@@ -35,12 +38,90 @@ static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
     }
 }
 
+/*
+ * These helpers are only called when the inline expansion would be too
+ * large, i.e. for long vectors.  Where the host has AVX2, process the
+ * bulk of the common element-wise operations 32 bytes at a time; the
+ * returned byte count is where the scalar loop picks up the remainder.
+ * The implementation is chosen once at startup, as in bufferiszero.c.
+ */
+#define FOR_EACH_ACCEL_3(X)            \
+    X(gvec_add8, vec256_8, x + y)       \
+    X(gvec_add16, vec256_16, x + y)     \
+    X(gvec_add32, vec256_32, x + y)     \
+    X(gvec_add64, vec256_64, x + y)     \
+    X(gvec_sub8, vec256_8, x - y)       \
+    X(gvec_sub16, vec256_16, x - y)     \
+    X(gvec_sub32, vec256_32, x - y)     \
+    X(gvec_sub64, vec256_64, x - y)     \
+    X(gvec_mul16, vec256_16, x * y)     \
+    X(gvec_mul32, vec256_32, x * y)     \
+    X(gvec_and, vec256_64, x & y)       \
+    X(gvec_or, vec256_64, x | y)        \
+    X(gvec_xor, vec256_64, x ^ y)       \
+    X(gvec_andc, vec256_64, x & ~y)     \
+    X(gvec_orc, vec256_64, x | ~y)
+
+#ifdef CONFIG_AVX2_OPT
+#define VEC256_ATTR  __attribute__((vector_size(32), may_alias, aligned(1)))
+typedef uint8_t vec256_8 VEC256_ATTR;
+typedef uint16_t vec256_16 VEC256_ATTR;
+typedef uint32_t vec256_32 VEC256_ATTR;
+typedef uint64_t vec256_64 VEC256_ATTR;
+
+typedef intptr_t (*gvec_accel_3_fn)(void *, void *, void *, intptr_t);
+
+static intptr_t gvec_accel_3_none(void *d, void *a, void *b, intptr_t oprsz)
+{
+    return 0;
+}
+
+#define GEN_ACCEL_3(NAME, VTYPE, OP)                                    \
+static intptr_t __attribute__((target("avx2")))                         \
+NAME##_avx2(void *d, void *a, void *b, intptr_t oprsz)                  \
+{                                                                       \
+    intptr_t i;                                                         \
+    for (i = 0; i + 32 <= oprsz; i += 32) {                             \
+        VTYPE x = *(VTYPE *)(a + i);                                    \
+        VTYPE y = *(VTYPE *)(b + i);                                    \
+        *(VTYPE *)(d + i) = OP;                                         \
+    }                                                                   \
+    return i;                                                           \
+}                                                                       \
+static gvec_accel_3_fn NAME##_accel = gvec_accel_3_none;
+
+FOR_EACH_ACCEL_3(GEN_ACCEL_3)
+#undef GEN_ACCEL_3
+
+#define INIT_ACCEL_3(NAME, VTYPE, OP)  NAME##_accel = NAME##_avx2;
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    if (cpuinfo_init() & CPUINFO_AVX2) {
+        FOR_EACH_ACCEL_3(INIT_ACCEL_3)
+    }
+}
+#undef INIT_ACCEL_3
+#else
+#define GEN_ACCEL_3(NAME, VTYPE, OP)                                    \
+static inline intptr_t NAME##_accel(void *d, void *a, void *b,          \
+                                    intptr_t oprsz)                     \
+{                                                                       \
+    return 0;                                                           \
+}
+
+FOR_EACH_ACCEL_3(GEN_ACCEL_3)
+#undef GEN_ACCEL_3
+#endif
+#undef FOR_EACH_ACCEL_3
+
 void HELPER(gvec_add8)(void *d, void *a, void *b, uint32_t desc)
 {
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_add8_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = *(uint8_t *)(a + i) + *(uint8_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -51,7 +132,8 @@ void HELPER(gvec_add16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_add16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) + *(uint16_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -62,7 +144,8 @@ void HELPER(gvec_add32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_add32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) + *(uint32_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -73,7 +156,8 @@ void HELPER(gvec_add64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_add64_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) + *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -128,7 +212,8 @@ void HELPER(gvec_sub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_sub8_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = *(uint8_t *)(a + i) - *(uint8_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -139,7 +224,8 @@ void HELPER(gvec_sub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_sub16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) - *(uint16_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -150,7 +236,8 @@ void HELPER(gvec_sub32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_sub32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) - *(uint32_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -161,7 +248,8 @@ void HELPER(gvec_sub64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_sub64_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) - *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -227,7 +315,8 @@ void HELPER(gvec_mul16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_mul16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) * *(uint16_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -238,7 +327,8 @@ void HELPER(gvec_mul32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_mul32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) * *(uint32_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -455,7 +545,8 @@ void HELPER(gvec_and)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_and_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) & *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -466,7 +557,8 @@ void HELPER(gvec_or)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_or_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) | *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -477,7 +569,8 @@ void HELPER(gvec_xor)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_xor_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) ^ *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -488,7 +581,8 @@ void HELPER(gvec_andc)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_andc_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) &~ *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -499,7 +593,8 @@ void HELPER(gvec_orc)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_orc_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) |~ *(uint64_t *)(b + i);
     }
     clear_high(d, oprsz, desc);
@@ -132,6 +132,32 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void dump_region_info(GString *buf)
+{
+    size_t n = tcg_nb_regions();
+    size_t used = tcg_nb_regions_used();
+    struct qdist tbs;
+    char *hgram;
+    double avg;
+    size_t i;
+
+    g_string_append_printf(buf, "code regions        %zu/%zu used\n",
+                           used, n);
+
+    qdist_init(&tbs);
+    for (i = 0; i < used; i++) {
+        qdist_inc(&tbs, tcg_region_nb_tbs(i));
+    }
+    avg = qdist_avg(&tbs);
+    if (!isnan(avg)) {
+        hgram = qdist_pr(&tbs, 10, QDIST_PR_BORDER | QDIST_PR_LABELS);
+        g_string_append_printf(buf, "TBs per region      %0.1f avg. "
+                               "Histogram: %s\n", avg, hgram);
+        g_free(hgram);
+    }
+    qdist_destroy(&tbs);
+}
+
 static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -155,6 +181,12 @@ static void tcg_dump_flush_info(GString *buf)
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB translate count  %u\n",
+                           qatomic_read(&tb_ctx.tb_gen_count));
+    g_string_append_printf(buf, "TB restart count    %u\n",
+                           qatomic_read(&tb_ctx.tb_gen_restart_count));
+    g_string_append_printf(buf, "TB discard count    %u\n",
+                           qatomic_read(&tb_ctx.tb_gen_discard_count));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
@@ -180,6 +212,7 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "gen code size       %zu/%zu\n",
                            tcg_code_size(), tcg_code_capacity());
     g_string_append_printf(buf, "TB count            %zu\n", nb_tbs);
+    dump_region_info(buf);
     g_string_append_printf(buf, "TB avg target size  %zu max=%zu bytes\n",
                            nb_tbs ? tst.target_size / nb_tbs : 0,
                            tst.max_target_size);
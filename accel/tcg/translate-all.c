@@ -324,6 +324,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
 
     gen_code_size = setjmp_gen_code(env, tb, s.pc, host_pc, &max_insns, &ti);
     if (unlikely(gen_code_size < 0)) {
+        qatomic_inc(&tb_ctx.tb_gen_restart_count);
         switch (gen_code_size) {
         case -1:
             trace_tb_gen_code_buffer_overflow("setjmp_gen_code");
@@ -392,10 +393,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
     if (unlikely(search_size < 0)) {
         trace_tb_gen_code_buffer_overflow("encode_search");
+        qatomic_inc(&tb_ctx.tb_gen_restart_count);
         tb_unlock_pages(tb);
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    qatomic_inc(&tb_ctx.tb_gen_count);
 
     /*
      * For CF_PCREL, attribute all executions of the generated code
@@ -536,6 +539,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
         orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
         qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
         tcg_tb_remove(tb);
+        qatomic_inc(&tb_ctx.tb_gen_discard_count);
         return existing_tb;
     }
     return tb;
@@ -24,6 +24,7 @@
 #include "tcg/tcg.h"
 #include "qemu/bitops.h"
 #include "qemu/rcu.h"
+#include "qemu/seqlock.h"
 #include "accel/tcg/cpu-ldst-common.h"
 #include "accel/tcg/helper-retaddr.h"
 #include "accel/tcg/probe.h"
@@ -167,6 +168,54 @@ typedef struct PageFlagsNode {
 
 static IntervalTreeRoot pageflags_root;
 
+/*
+ * Lockless lookups are frequent (access_ok, lock_user, TB lookup), and
+ * multi-threaded guests tend to hit the same few mappings over and over.
+ * Remember the last successful lookup in a per-thread cache, which is
+ * valid for as long as pageflags_seq does not change.  The sequence is
+ * bumped, with mmap_lock held, around every update of the tree.
+ */
+typedef struct PageFlagsCache {
+    unsigned seq;
+    vaddr start;
+    vaddr last;
+    int flags;
+} PageFlagsCache;
+
+static QemuSeqLock pageflags_seq;
+
+/* Initially empty: start > last. */
+static __thread PageFlagsCache pageflags_cache = { .start = 1 };
+
+static bool pageflags_cache_find(vaddr start, vaddr last, int *flags)
+{
+    PageFlagsCache *c = &pageflags_cache;
+    unsigned seq = seqlock_read_begin(&pageflags_seq);
+
+    if (c->seq == seq && c->start <= start && last <= c->last
+        && !seqlock_read_retry(&pageflags_seq, seq)) {
+        *flags = c->flags;
+        return true;
+    }
+    return false;
+}
+
+static void pageflags_cache_fill(PageFlagsNode *p, unsigned seq)
+{
+    PageFlagsCache *c = &pageflags_cache;
+    vaddr start = p->itree.start;
+    vaddr last = p->itree.last;
+    int flags = p->flags;
+
+    /* Only a node read while no update was in progress is consistent. */
+    if (!seqlock_read_retry(&pageflags_seq, seq)) {
+        c->seq = seq;
+        c->start = start;
+        c->last = last;
+        c->flags = flags;
+    }
+}
+
 static PageFlagsNode *pageflags_find(vaddr start, vaddr last)
 {
     IntervalTreeNode *n;
@@ -238,7 +287,16 @@ void page_dump(FILE *f)
 
 int page_get_flags(vaddr address)
 {
-    PageFlagsNode *p = pageflags_find(address, address);
+    PageFlagsNode *p;
+    unsigned seq;
+    int flags;
+
+    if (pageflags_cache_find(address, address, &flags)) {
+        return flags;
+    }
+
+    seq = seqlock_read_begin(&pageflags_seq);
+    p = pageflags_find(address, address);
 
     /*
      * See util/interval-tree.c re lockless lookups: no false positives but
@@ -246,7 +304,9 @@ int page_get_flags(vaddr address)
      * lock acquired.
      */
     if (p) {
-        return p->flags;
+        flags = p->flags;
+        pageflags_cache_fill(p, seq);
+        return flags;
     }
     if (have_mmap_lock()) {
         return 0;
@@ -323,6 +383,8 @@ static bool pageflags_set_clear(vaddr start, vaddr last,
     int p_flags, merge_flags;
     bool inval_tb = false;
 
+    seqlock_write_begin(&pageflags_seq);
+
  restart:
     p = pageflags_find(start, last);
     if (!p) {
@@ -452,6 +514,7 @@ static bool pageflags_set_clear(vaddr start, vaddr last,
     }
 
  done:
+    seqlock_write_end(&pageflags_seq);
     return inval_tb;
 }
 
@@ -493,6 +556,7 @@ bool page_check_range(vaddr start, vaddr len, int flags)
 {
     vaddr last;
     int locked;  /* tri-state: =0: unlocked, +1: global, -1: local */
+    int cached;
     bool ret;
 
     if (len == 0) {
@@ -504,6 +568,11 @@ bool page_check_range(vaddr start, vaddr len, int flags)
         return false; /* wrap around */
     }
 
+    if (pageflags_cache_find(start, last, &cached)
+        && !(flags & ~cached)) {
+        return true;
+    }
+
     locked = have_mmap_lock();
     while (true) {
         PageFlagsNode *p = pageflags_find(start, last);
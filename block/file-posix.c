@@ -37,6 +37,7 @@
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
 #include "qobject/qdict.h"
+#include "system/memory.h" /* for ram_block_discard_disable() */
 #include "qobject/qstring.h"
 
 #include "scsi/pr-manager.h"
@@ -183,6 +184,7 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_io_uring_fixed_bufs:1;
     bool use_mpath:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
@@ -197,6 +199,10 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+#ifdef CONFIG_LINUX_IO_URING
+    LuringFixed *luring_fixed;
+    LuringNvme nvme;
+#endif
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -607,6 +613,13 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "x-io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with io_uring (default: off)",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -662,6 +675,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_io_uring_fixed_bufs = qemu_opt_get_bool(opts,
+                                                   "x-io-uring-fixed-buffers",
+                                                   false);
+    if (s->use_io_uring_fixed_bufs && !s->use_linux_io_uring) {
+        error_setg(errp, "x-io-uring-fixed-buffers=on requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -799,6 +820,21 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             ret = -EINVAL;
             goto fail;
         }
+#ifdef CONFIG_LINUX_IO_URING
+        if (S_ISCHR(st.st_mode)) {
+            ret = luring_nvme_probe(s->fd, &s->nvme, errp);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+        if (s->nvme.nsid && !s->use_linux_io_uring) {
+            /* Generic char devices only support passthrough commands */
+            error_setg(errp, "NVMe generic char device '%s' requires "
+                       "aio=io_uring", bs->filename);
+            ret = -EINVAL;
+            goto fail;
+        }
+#endif
     }
 #ifdef CONFIG_BLKZONED
     /*
@@ -832,12 +868,39 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     } else if (s->use_linux_io_uring && !luring_has_fua()) {
         bs->supported_write_flags &= ~BDRV_REQ_FUA;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->nvme.nsid) {
+        /* NVMe writes have their own FUA bit */
+        bs->supported_write_flags |= BDRV_REQ_FUA;
+    }
+#endif
 
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK;
     if (S_ISREG(st.st_mode)) {
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring_fixed_bufs) {
+        /*
+         * Registered buffers stay pinned, discarding guest RAM would leave
+         * stale pages behind them.
+         */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "x-io-uring-fixed-buffers=on "
+                             "conflicts with RAM discard");
+            goto fail;
+        }
+        bs->supported_write_flags |= BDRV_REQ_REGISTERED_BUF;
+    }
+    /* Passthrough commands use a separate ring without registered files */
+    if (s->use_linux_io_uring && !s->nvme.nsid) {
+        s->luring_fixed = luring_fixed_new(bdrv_get_aio_context(bs), s->fd,
+                                           s->use_io_uring_fixed_bufs);
+    }
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1380,6 +1443,94 @@ static int hdev_get_pdiscard_alignment(struct stat *st, uint32_t *dalign)
 #endif
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Get a queue limit of the NVMe namespace behind a generic char device.
+ *
+ * The char device has no queue directory, but passthrough commands are
+ * checked against the request queue of the namespace, whose block device
+ * (nvmeXnY, or nvmeXcYnZ for a path of a multipath namespace) sits next to
+ * the char device under the controller or subsystem.
+ */
+static long nvme_generic_get_queue_limit(struct stat *st, uint32_t nsid,
+                                         const char *attribute)
+{
+    g_autofree char *parent = NULL;
+    g_autofree char *suffix = NULL;
+    const char *name;
+    long ret = -ENOENT;
+    GDir *dir;
+
+    parent = g_strdup_printf("/sys/dev/char/%u:%u/device",
+                             major(st->st_rdev), minor(st->st_rdev));
+    dir = g_dir_open(parent, 0, NULL);
+    if (!dir) {
+        return -ENOENT;
+    }
+
+    suffix = g_strdup_printf("n%u", nsid);
+    while ((name = g_dir_read_name(dir))) {
+        g_autofree char *path = NULL;
+        g_autofree char *str = NULL;
+        const char *end;
+        long val;
+
+        if (!g_str_has_prefix(name, "nvme") ||
+            !g_str_has_suffix(name, suffix)) {
+            continue;
+        }
+
+        path = g_strdup_printf("%s/%s/queue/%s", parent, name, attribute);
+        if (!g_file_get_contents(path, &str, NULL, NULL)) {
+            continue;
+        }
+
+        /* The file is ended with '\n', pass 'end' to accept that. */
+        ret = qemu_strtol(str, &end, 10, &val);
+        if (ret == 0) {
+            ret = val;
+        }
+        break;
+    }
+
+    g_dir_close(dir);
+    return ret;
+}
+
+static void raw_refresh_nvme_limits(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    struct stat st;
+    long ret;
+
+    /* Commands address whole blocks, data pointers must be dword aligned */
+    bs->bl.request_alignment = 1 << s->nvme.lba_shift;
+    s->buf_align = 4;
+    bs->bl.min_mem_alignment = s->buf_align;
+    bs->bl.opt_mem_alignment = qemu_real_host_page_size();
+    bs->bl.max_transfer = s->nvme.max_transfer;
+
+    if (fstat(s->fd, &st)) {
+        return;
+    }
+
+    /* Best effort, like for other devices: keep what MDTS says on errors */
+    ret = nvme_generic_get_queue_limit(&st, s->nvme.nsid, "max_hw_sectors_kb");
+    if (ret > 0 && ret <= BDRV_REQUEST_MAX_BYTES / KiB) {
+        bs->bl.max_transfer = MIN_NON_ZERO(bs->bl.max_transfer, ret * KiB);
+        bs->bl.max_transfer = QEMU_ALIGN_DOWN(bs->bl.max_transfer,
+                                              bs->bl.request_alignment);
+        bs->bl.max_hw_transfer = bs->bl.max_transfer;
+    }
+
+    ret = nvme_generic_get_queue_limit(&st, s->nvme.nsid, "max_segments");
+    if (ret > 0) {
+        bs->bl.max_hw_iov = ret;
+        s->nvme.max_segments = ret;
+    }
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 #if defined(CONFIG_BLKZONED)
 /*
  * If the reset_all flag is true, then the wps of zone whose state is
@@ -1552,6 +1703,13 @@ static void raw_refresh_limits(BlockDriverState *bs, Error **errp)
     BDRVRawState *s = bs->opaque;
     struct stat st;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->nvme.nsid) {
+        raw_refresh_nvme_limits(bs);
+        return;
+    }
+#endif
+
     s->needs_alignment = raw_needs_alignment(bs);
     raw_probe_alignment(bs, s->fd, errp);
 
@@ -1653,6 +1811,13 @@ static int hdev_probe_blocksizes(BlockDriverState *bs, BlockSizes *bsz)
     BDRVRawState *s = bs->opaque;
     int ret;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->nvme.nsid) {
+        bsz->log = bsz->phys = 1 << s->nvme.lba_shift;
+        return 0;
+    }
+#endif
+
     /* If DASD or zoned devices, get blocksizes */
     if (check_for_dasd(s->fd) < 0) {
         /* zoned devices are not DASD */
@@ -2579,6 +2744,13 @@ raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr, uint64_t bytes,
 
     if (fd_open(bs) < 0)
         return -EIO;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->nvme.nsid) {
+        assert(qiov->size == bytes);
+        return luring_co_submit_nvme(bs, s->fd, &s->nvme, offset, qiov, type,
+                                     flags);
+    }
+#endif
 #if defined(CONFIG_BLKZONED)
     if ((type & (QEMU_AIO_WRITE | QEMU_AIO_ZONE_APPEND)) &&
         bs->bl.zoned != BLK_Z_NONE) {
@@ -2601,7 +2773,8 @@ raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr, uint64_t bytes,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type, flags);
+        ret = luring_co_submit(bs, s->fd, s->luring_fixed, offset, qiov,
+                               type, flags);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2696,8 +2869,14 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
+    if (s->nvme.nsid) {
+        /* fdatasync() does not reach the device through a char device */
+        return luring_co_submit_nvme(bs, s->fd, &s->nvme, 0, NULL,
+                                     QEMU_AIO_FLUSH, 0);
+    }
     if (s->use_linux_io_uring) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0);
+        return luring_co_submit(bs, s->fd, s->luring_fixed, 0, NULL,
+                                QEMU_AIO_FLUSH, 0);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2712,6 +2891,14 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    luring_fixed_free(s->luring_fixed);
+    s->luring_fixed = NULL;
+    if (s->use_io_uring_fixed_bufs) {
+        ram_block_discard_disable(false);
+    }
+#endif
+
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
@@ -2721,6 +2908,47 @@ static void raw_close(BlockDriverState *bs)
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (!s->luring_fixed) {
+        return true;
+    }
+    return luring_fixed_register_buf(s->luring_fixed, host, size, errp);
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->luring_fixed) {
+        luring_fixed_unregister_buf(s->luring_fixed, host, size);
+    }
+}
+
+static void raw_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->luring_fixed) {
+        luring_fixed_detach_aio_context(s->luring_fixed);
+    }
+}
+
+static void raw_attach_aio_context(BlockDriverState *bs,
+                                   AioContext *new_context)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->luring_fixed) {
+        luring_fixed_attach_aio_context(s->luring_fixed, new_context);
+    }
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -2949,6 +3177,12 @@ static int64_t raw_getlength(BlockDriverState *bs)
         return ret;
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->nvme.nsid) {
+        return s->nvme.nsze << s->nvme.lba_shift;
+    }
+#endif
+
     size = lseek(s->fd, 0, SEEK_END);
     if (size < 0) {
         return -errno;
@@ -3908,6 +4142,11 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->luring_fixed) {
+            luring_fixed_set_fd(s->luring_fixed, s->perm_change_fd);
+        }
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -4000,6 +4239,12 @@ BlockDriver bdrv_file = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
+#endif
     .bdrv_co_flush_to_disk  = raw_co_flush_to_disk,
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
@@ -4470,6 +4715,12 @@ static BlockDriver bdrv_host_device = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
+#endif
     .bdrv_co_flush_to_disk  = raw_co_flush_to_disk,
     .bdrv_co_pdiscard       = hdev_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
@@ -4608,6 +4859,12 @@ static BlockDriver bdrv_host_cdrom = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
+    .bdrv_attach_aio_context = raw_attach_aio_context,
+#endif
     .bdrv_co_flush_to_disk  = raw_co_flush_to_disk,
     .bdrv_refresh_limits    = cdrom_refresh_limits,
 
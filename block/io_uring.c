@@ -10,13 +10,44 @@
  */
 #include "qemu/osdep.h"
 #include <liburing.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_NVME_URING_CMD
+#include <linux/nvme_ioctl.h>
+#endif
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/nvme.h"
 #include "block/raw-aio.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
 #include "qemu/coroutine.h"
+#include "qemu/memalign.h"
+#include "qemu/units.h"
 #include "system/block-backend.h"
 #include "trace.h"
 
+/* The kernel limits each registered buffer to 1 GiB */
+#define LURING_FIXED_BUF_MAX    (1 * GiB)
+
+typedef struct {
+    void *host;
+    size_t size;
+    int index;      /* of the first 1 GiB chunk in the registered buffers */
+} LuringFixedBuf;
+
+/*
+ * Registered file and buffers of a BlockDriverState in the io_uring of its
+ * AioContext.  Requests submitted from other AioContexts, which happens with
+ * multiqueue, use the plain file descriptor and iovecs.
+ */
+struct LuringFixed {
+    AioContext *ctx;        /* NULL while detached */
+    int fd;
+    int file_index;         /* -1 if not registered */
+    bool use_bufs;
+    GArray *bufs;           /* LuringFixedBuf, only with use_bufs */
+};
+
 typedef struct {
     Coroutine *co;
     QEMUIOVector *qiov;
@@ -24,6 +55,8 @@ typedef struct {
     ssize_t ret;
     int type;
     int fd;
+    LuringFixed *fixed;     /* NULL if the request doesn't use it */
+    const LuringNvme *nvme; /* NULL unless this is a passthrough command */
     BdrvRequestFlags flags;
 
     /*
@@ -36,19 +69,133 @@ typedef struct {
     CqeHandler cqe_handler;
 } LuringRequest;
 
+static int luring_fixed_buf_index(LuringFixed *fixed, struct iovec *iov)
+{
+    uint8_t *base = iov->iov_base;
+    guint i;
+
+    for (i = 0; i < fixed->bufs->len; i++) {
+        LuringFixedBuf *buf = &g_array_index(fixed->bufs, LuringFixedBuf, i);
+        size_t start, end;
+
+        if (buf->index < 0 || base < (uint8_t *)buf->host ||
+            base + iov->iov_len > (uint8_t *)buf->host + buf->size) {
+            continue;
+        }
+
+        /* The request must not straddle two chunks */
+        start = (base - (uint8_t *)buf->host) / LURING_FIXED_BUF_MAX;
+        end = (base + iov->iov_len - 1 - (uint8_t *)buf->host) /
+              LURING_FIXED_BUF_MAX;
+        return start == end ? buf->index + start : -1;
+    }
+    return -1;
+}
+
+/*
+ * Prepare a single buffer read or write, with the registered buffer that
+ * contains it if any
+ */
+static void luring_prep_rw(struct io_uring_sqe *sqe, LuringRequest *req,
+                           int fd, struct iovec *iov, uint64_t offset,
+                           bool write)
+{
+    int buf_index = -1;
+
+    if (req->fixed && req->fixed->use_bufs &&
+        (req->flags & BDRV_REQ_REGISTERED_BUF)) {
+        buf_index = luring_fixed_buf_index(req->fixed, iov);
+    }
+
+    if (buf_index >= 0 && write) {
+        io_uring_prep_write_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                  offset, buf_index);
+    } else if (buf_index >= 0) {
+        io_uring_prep_read_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                 offset, buf_index);
+    } else if (write) {
+        io_uring_prep_write(sqe, fd, iov->iov_base, iov->iov_len, offset);
+    } else {
+        io_uring_prep_read(sqe, fd, iov->iov_base, iov->iov_len, offset);
+    }
+}
+
+#ifdef HAVE_NVME_URING_CMD
+/* Prepare an NVMe I/O command for the namespace behind a generic char device */
+static void luring_prep_nvme(struct io_uring_sqe *sqe, LuringRequest *req,
+                             int fd)
+{
+    const LuringNvme *nvme = req->nvme;
+    QEMUIOVector *qiov = req->qiov;
+    struct nvme_uring_cmd *cmd;
+    uint64_t slba;
+
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+    sqe->cmd_op = NVME_URING_CMD_IO;
+    cmd = (struct nvme_uring_cmd *)sqe->cmd;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->nsid = nvme->nsid;
+
+    switch (req->type) {
+    case QEMU_AIO_READ:
+    case QEMU_AIO_WRITE:
+        cmd->opcode = req->type == QEMU_AIO_READ ? NVME_CMD_READ :
+                                                   NVME_CMD_WRITE;
+        if (qiov->niov > 1) {
+            sqe->cmd_op = NVME_URING_CMD_IO_VEC;
+            cmd->addr = (uintptr_t)qiov->iov;
+            cmd->data_len = qiov->niov;
+        } else {
+            cmd->addr = (uintptr_t)qiov->iov->iov_base;
+            cmd->data_len = qiov->iov->iov_len;
+        }
+
+        /* The kernel converts the command to little endian */
+        slba = req->offset >> nvme->lba_shift;
+        cmd->cdw10 = slba;
+        cmd->cdw11 = slba >> 32;
+        cmd->cdw12 = (qiov->size >> nvme->lba_shift) - 1;
+        if (req->flags & BDRV_REQ_FUA) {
+            cmd->cdw12 |= NVME_RW_FUA << 16;
+        }
+        break;
+    case QEMU_AIO_FLUSH:
+        cmd->opcode = NVME_CMD_FLUSH;
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type, aborting 0x%x.\n",
+                        __func__, req->type);
+        abort();
+    }
+}
+#endif /* HAVE_NVME_URING_CMD */
+
 static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
 {
     LuringRequest *req = opaque;
     QEMUIOVector *qiov = req->qiov;
     uint64_t offset = req->offset;
-    int fd = req->fd;
+    int fd = req->fixed ? req->fixed->file_index : req->fd;
     BdrvRequestFlags flags = req->flags;
 
+    if (req->nvme) {
+#ifdef HAVE_NVME_URING_CMD
+        luring_prep_nvme(sqe, req, fd);
+        return;
+#else
+        g_assert_not_reached();
+#endif
+    }
+
     switch (req->type) {
     case QEMU_AIO_WRITE:
     {
         int luring_flags = (flags & BDRV_REQ_FUA) ? RWF_DSYNC : 0;
-        if (luring_flags != 0 || qiov->niov > 1) {
+        if (luring_flags != 0 && qiov->niov == 1 && req->fixed) {
+            /* rw_flags apply to fixed buffer writes as well */
+            luring_prep_rw(sqe, req, fd, qiov->iov, offset, true);
+            sqe->rw_flags = luring_flags;
+        } else if (luring_flags != 0 || qiov->niov > 1) {
 #ifdef HAVE_IO_URING_PREP_WRITEV2
             io_uring_prep_writev2(sqe, fd, qiov->iov,
                                   qiov->niov, offset, luring_flags);
@@ -63,8 +210,7 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
 #endif
         } else {
             /* The man page says non-vectored is faster than vectored */
-            struct iovec *iov = qiov->iov;
-            io_uring_prep_write(sqe, fd, iov->iov_base, iov->iov_len, offset);
+            luring_prep_rw(sqe, req, fd, qiov->iov, offset, true);
         }
         break;
     }
@@ -81,9 +227,8 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
                                 offset + req->total_read);
         } else {
             /* The man page says non-vectored is faster than vectored */
-            struct iovec *iov = qiov->iov;
-            io_uring_prep_read(sqe, fd, iov->iov_base, iov->iov_len,
-                               offset + req->total_read);
+            luring_prep_rw(sqe, req, fd, qiov->iov, offset + req->total_read,
+                           false);
         }
         break;
     }
@@ -95,6 +240,20 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
                         __func__, req->type);
         abort();
     }
+
+    if (req->fixed) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+/* Passthrough commands need the AioContext's ring with big sqes and cqes */
+static void luring_add_sqe(LuringRequest *req)
+{
+    if (req->nvme) {
+        aio_add_sqe_cmd(luring_prep_sqe, req, &req->cqe_handler);
+    } else {
+        aio_add_sqe(luring_prep_sqe, req, &req->cqe_handler);
+    }
 }
 
 /**
@@ -123,7 +282,7 @@ static void luring_resubmit_short_read(LuringRequest *req, int nread)
     }
     qemu_iovec_concat(resubmit_qiov, req->qiov, req->total_read, remaining);
 
-    aio_add_sqe(luring_prep_sqe, req, &req->cqe_handler);
+    luring_add_sqe(req);
 }
 
 static void luring_cqe_handler(CqeHandler *cqe_handler)
@@ -135,23 +294,34 @@ static void luring_cqe_handler(CqeHandler *cqe_handler)
 
     if (ret < 0) {
         /*
-         * Only writev/readv/fsync requests on regular files or host block
-         * devices are submitted. Therefore -EAGAIN is not expected but it's
-         * known to happen sometimes with Linux SCSI. Submit again and hope
-         * the request completes successfully.
+         * Reads, writes and fsyncs on regular files or host block devices,
+         * and NVMe Read, Write and Flush passthrough commands are submitted.
+         * -EAGAIN is not expected but it's known to happen sometimes with
+         * Linux SCSI. Submit again and hope the request completes
+         * successfully.
          *
          * For more information, see:
          * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
          *
+         * For passthrough, io_uring punts -EAGAIN from submission to a worker
+         * itself, so such a cqe can only come from the host driver failing to
+         * allocate a request, and -EINTR from a signal before the command was
+         * issued.  The device has then not seen the command, and even if it
+         * had, these three commands are idempotent, so resubmitting is safe.
+         * NVMe errors are reported as a positive status and are not retried.
+         *
          * If the code is changed to submit other types of requests in the
          * future, then this workaround may need to be extended to deal with
          * genuine -EAGAIN results that should not be resubmitted
          * immediately.
          */
         if (ret == -EINTR || ret == -EAGAIN) {
-            aio_add_sqe(luring_prep_sqe, req, &req->cqe_handler);
+            luring_add_sqe(req);
             return;
         }
+    } else if (req->nvme) {
+        /* Passthrough commands complete with the NVMe status, not a length */
+        ret = ret ? -EIO : 0;
     } else if (req->qiov) {
         /* total_read is non-zero only for resubmitted read requests */
         int total_bytes = ret + req->total_read;
@@ -189,29 +359,170 @@ static void luring_cqe_handler(CqeHandler *cqe_handler)
     }
 }
 
+static int coroutine_fn luring_do_submit(BlockDriverState *bs,
+                                         LuringRequest *req)
+{
+    req->co = qemu_coroutine_self();
+    req->ret = -EINPROGRESS;
+    req->cqe_handler.cb = luring_cqe_handler;
+
+    trace_luring_co_submit(bs, req, req->fd, req->offset,
+                           req->qiov ? req->qiov->size : 0, req->type);
+    luring_add_sqe(req);
+
+    if (req->ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return req->ret;
+}
+
+static LuringFixed *luring_fixed_get(LuringFixed *fixed, int fd)
+{
+    if (fixed && fixed->file_index >= 0 && fixed->fd == fd &&
+        fixed->ctx == qemu_get_current_aio_context()) {
+        return fixed;
+    }
+    return NULL;
+}
+
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd,
-                                  uint64_t offset, QEMUIOVector *qiov,
-                                  int type, BdrvRequestFlags flags)
+                                  LuringFixed *fixed, uint64_t offset,
+                                  QEMUIOVector *qiov, int type,
+                                  BdrvRequestFlags flags)
+{
+    LuringRequest req = {
+        .qiov       = qiov,
+        .type       = type,
+        .fd         = fd,
+        .fixed      = luring_fixed_get(fixed, fd),
+        .offset     = offset,
+        .flags      = flags,
+    };
+
+    return luring_do_submit(bs, &req);
+}
+
+int coroutine_fn luring_co_submit_nvme(BlockDriverState *bs, int fd,
+                                       const LuringNvme *nvme,
+                                       uint64_t offset, QEMUIOVector *qiov,
+                                       int type, BdrvRequestFlags flags)
 {
+    QEMU_AUTO_VFREE void *bounce_buf = NULL;
+    QEMUIOVector bounce_qiov;
+    /* Registered files belong to the other ring, so fd is used as is */
     LuringRequest req = {
-        .co         = qemu_coroutine_self(),
         .qiov       = qiov,
-        .ret        = -EINPROGRESS,
         .type       = type,
         .fd         = fd,
+        .nvme       = nvme,
         .offset     = offset,
         .flags      = flags,
     };
+    int ret;
 
-    req.cqe_handler.cb = luring_cqe_handler;
+    assert(nvme->nsid);
+    assert(QEMU_IS_ALIGNED(offset | (qiov ? qiov->size : 0),
+                           1 << nvme->lba_shift));
 
-    trace_luring_co_submit(bs, &req, fd, offset, qiov ? qiov->size : 0, type);
-    aio_add_sqe(luring_prep_sqe, &req, &req.cqe_handler);
+    /*
+     * Unlike block I/O, passthrough commands are not split by the kernel,
+     * which fails them if they have more segments than the namespace's queue
+     * allows.  max_transfer keeps a contiguous buffer within the limit.
+     */
+    if (qiov && nvme->max_segments && qiov->niov > nvme->max_segments) {
+        bounce_buf = qemu_try_memalign(qemu_real_host_page_size(), qiov->size);
+        if (!bounce_buf) {
+            return -ENOMEM;
+        }
+        if (type == QEMU_AIO_WRITE) {
+            qemu_iovec_to_buf(qiov, 0, bounce_buf, qiov->size);
+        }
+        qemu_iovec_init_buf(&bounce_qiov, bounce_buf, qiov->size);
+        req.qiov = &bounce_qiov;
+    }
 
-    if (req.ret == -EINPROGRESS) {
-        qemu_coroutine_yield();
+    ret = luring_do_submit(bs, &req);
+    if (ret == 0 && bounce_buf && type == QEMU_AIO_READ) {
+        qemu_iovec_from_buf(qiov, 0, bounce_buf, qiov->size);
     }
-    return req.ret;
+    return ret;
+}
+
+int luring_nvme_probe(int fd, LuringNvme *nvme, Error **errp)
+{
+#ifdef HAVE_NVME_URING_CMD
+    QEMU_AUTO_VFREE union {
+        NvmeIdCtrl ctrl;
+        NvmeIdNs ns;
+    } *id = NULL;
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADM_CMD_IDENTIFY,
+        .cdw10 = 0x1,
+    };
+    NvmeLBAF *lbaf;
+    int nsid;
+
+    *nvme = (LuringNvme) { 0 };
+
+    /* Only namespaces, including their generic char devices, have an ID */
+    nsid = ioctl(fd, NVME_IOCTL_ID);
+    if (nsid <= 0) {
+        return 0;
+    }
+
+    if (!aio_has_io_uring_cmd()) {
+        error_setg(errp, "NVMe passthrough requires io_uring with 128 byte "
+                   "sqes (Linux 5.19 or newer)");
+        return -ENOTSUP;
+    }
+
+    id = qemu_memalign(qemu_real_host_page_size(), sizeof(*id));
+    memset(id, 0, sizeof(*id));
+    cmd.addr = (uintptr_t)id;
+    cmd.data_len = sizeof(*id);
+    if (ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd) != 0) {
+        error_setg(errp, "Failed to identify controller");
+        return -EIO;
+    }
+
+    /*
+     * Assume the smallest controller page size.  The host driver may allow
+     * less, raw_refresh_limits() takes its queue limits into account.
+     * MDTS is a power of two that can go far beyond what a request may be,
+     * so clamp it before shifting and again to the block layer limit.
+     */
+    if (id->ctrl.mdts) {
+        uint64_t mdts = (4 * KiB) << MIN(id->ctrl.mdts, 20);
+        nvme->max_transfer = MIN(mdts, BDRV_REQUEST_MAX_BYTES);
+    }
+
+    memset(id, 0, sizeof(*id));
+    cmd.cdw10 = 0;
+    cmd.nsid = nsid;
+    if (ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd) != 0) {
+        error_setg(errp, "Failed to identify namespace");
+        return -EIO;
+    }
+
+    lbaf = &id->ns.lbaf[NVME_ID_NS_FLBAS_INDEX(id->ns.flbas)];
+    if (lbaf->ms) {
+        error_setg(errp, "Namespaces with metadata are not supported");
+        return -ENOTSUP;
+    }
+    if (lbaf->ds < BDRV_SECTOR_BITS || lbaf->ds > 12) {
+        error_setg(errp, "Namespace has unsupported block size (2^%d)",
+                   lbaf->ds);
+        return -ENOTSUP;
+    }
+
+    nvme->nsid = nsid;
+    nvme->lba_shift = lbaf->ds;
+    nvme->nsze = le64_to_cpu(id->ns.nsze);
+    return 0;
+#else
+    *nvme = (LuringNvme) { 0 };
+    return 0;
+#endif
 }
 
 bool luring_has_fua(void)
@@ -222,3 +533,165 @@ bool luring_has_fua(void)
     return false;
 #endif
 }
+
+static void luring_fixed_register_file(LuringFixed *fixed)
+{
+    int ret;
+
+    if (fixed->fd < 0) {
+        return;
+    }
+
+    ret = aio_register_fixed_file(fixed->ctx, fixed->fd);
+    trace_luring_fixed_register_file(fixed, fixed->fd, ret);
+    fixed->file_index = ret < 0 ? -1 : ret;
+}
+
+static void luring_fixed_unregister_file(LuringFixed *fixed)
+{
+    if (fixed->file_index >= 0) {
+        aio_unregister_fixed_file(fixed->ctx, fixed->file_index);
+        fixed->file_index = -1;
+    }
+}
+
+static int luring_fixed_register_one_buf(LuringFixed *fixed,
+                                         LuringFixedBuf *buf)
+{
+    unsigned n = DIV_ROUND_UP(buf->size, LURING_FIXED_BUF_MAX);
+    g_autofree struct iovec *iov = g_new(struct iovec, n);
+    unsigned i;
+    int ret;
+
+    for (i = 0; i < n; i++) {
+        iov[i] = (struct iovec) {
+            .iov_base = (uint8_t *)buf->host + i * LURING_FIXED_BUF_MAX,
+            .iov_len = MIN(LURING_FIXED_BUF_MAX,
+                           buf->size - i * LURING_FIXED_BUF_MAX),
+        };
+    }
+
+    ret = aio_register_fixed_bufs(fixed->ctx, iov, n);
+    trace_luring_fixed_register_buf(fixed, buf->host, buf->size, ret);
+    buf->index = ret < 0 ? -1 : ret;
+    return ret;
+}
+
+static void luring_fixed_unregister_one_buf(LuringFixed *fixed,
+                                            LuringFixedBuf *buf)
+{
+    if (buf->index >= 0) {
+        aio_unregister_fixed_bufs(fixed->ctx, buf->index,
+                                  DIV_ROUND_UP(buf->size,
+                                               LURING_FIXED_BUF_MAX));
+        buf->index = -1;
+    }
+}
+
+LuringFixed *luring_fixed_new(AioContext *ctx, int fd, bool use_bufs)
+{
+    LuringFixed *fixed = g_new0(LuringFixed, 1);
+
+    fixed->fd = fd;
+    fixed->file_index = -1;
+    fixed->use_bufs = use_bufs;
+    fixed->bufs = g_array_new(false, false, sizeof(LuringFixedBuf));
+    luring_fixed_attach_aio_context(fixed, ctx);
+    return fixed;
+}
+
+void luring_fixed_free(LuringFixed *fixed)
+{
+    if (!fixed) {
+        return;
+    }
+
+    luring_fixed_detach_aio_context(fixed);
+    g_array_free(fixed->bufs, true);
+    g_free(fixed);
+}
+
+void luring_fixed_set_fd(LuringFixed *fixed, int fd)
+{
+    luring_fixed_unregister_file(fixed);
+    fixed->fd = fd;
+    if (fixed->ctx) {
+        luring_fixed_register_file(fixed);
+    }
+}
+
+void luring_fixed_detach_aio_context(LuringFixed *fixed)
+{
+    guint i;
+
+    if (!fixed->ctx) {
+        return;
+    }
+
+    luring_fixed_unregister_file(fixed);
+    for (i = 0; i < fixed->bufs->len; i++) {
+        luring_fixed_unregister_one_buf(fixed, &g_array_index(fixed->bufs,
+                                                              LuringFixedBuf,
+                                                              i));
+    }
+    fixed->ctx = NULL;
+}
+
+void luring_fixed_attach_aio_context(LuringFixed *fixed, AioContext *ctx)
+{
+    guint i;
+
+    fixed->ctx = ctx;
+    luring_fixed_register_file(fixed);
+
+    /* Failing here only costs performance, the requests fall back */
+    for (i = 0; i < fixed->bufs->len; i++) {
+        luring_fixed_register_one_buf(fixed, &g_array_index(fixed->bufs,
+                                                            LuringFixedBuf,
+                                                            i));
+    }
+}
+
+bool luring_fixed_register_buf(LuringFixed *fixed, void *host, size_t size,
+                               Error **errp)
+{
+    LuringFixedBuf buf = {
+        .host = host,
+        .size = size,
+        .index = -1,
+    };
+    int ret;
+
+    if (!fixed->use_bufs) {
+        return true;
+    }
+
+    if (fixed->ctx) {
+        ret = luring_fixed_register_one_buf(fixed, &buf);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to register buffer %p with "
+                             "size %zu with io_uring", host, size);
+            return false;
+        }
+    }
+
+    g_array_append_val(fixed->bufs, buf);
+    return true;
+}
+
+void luring_fixed_unregister_buf(LuringFixed *fixed, void *host, size_t size)
+{
+    guint i;
+
+    for (i = 0; i < fixed->bufs->len; i++) {
+        LuringFixedBuf *buf = &g_array_index(fixed->bufs, LuringFixedBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            if (fixed->ctx) {
+                luring_fixed_unregister_one_buf(fixed, buf);
+            }
+            g_array_remove_index_fast(fixed->bufs, i);
+            return;
+        }
+    }
+}
@@ -28,11 +28,21 @@
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Cached tables are indexed by a hash table keyed by their offset, with
+ * the chains threaded through the entries, so that lookups do not depend
+ * on the size of the cache.  Replacement uses the CLOCK algorithm: a hit
+ * sets the reference bit of the entry, and on a miss the clock hand
+ * sweeps the entries, clearing the reference bits, until it finds an
+ * unused one whose bit is already clear.
+ */
 typedef struct Qcow2CachedTable {
     int64_t  offset;
-    uint64_t lru_counter;
+    int      next;          /* Next entry in the same hash chain, or -1 */
     int      ref;
     bool     dirty;
+    bool     referenced;    /* CLOCK reference bit */
+    bool     used;          /* Used since the last qcow2_cache_clean_unused() */
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -42,8 +52,9 @@ struct Qcow2Cache {
     int                     table_size;
     bool                    depends_on_flush;
     void                   *table_array;
-    uint64_t                lru_counter;
-    uint64_t                cache_clean_lru_counter;
+    int                    *buckets;
+    int                     bucket_bits;
+    int                     clock_hand;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +70,55 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline int *qcow2_cache_bucket(Qcow2Cache *c, uint64_t offset)
+{
+    uint64_t hash = (offset / c->table_size) * 0x9e3779b97f4a7c15ULL;
+    return &c->buckets[hash >> (64 - c->bucket_bits)];
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = *qcow2_cache_bucket(c, offset); i != -1; i = c->entries[i].next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void qcow2_cache_insert(Qcow2Cache *c, int i, uint64_t offset)
+{
+    int *bucket = qcow2_cache_bucket(c, offset);
+
+    assert(c->entries[i].offset == 0);
+    c->entries[i].offset = offset;
+    c->entries[i].next = *bucket;
+    *bucket = i;
+}
+
+/* Forget the offset of entry @i, its table contents become meaningless */
+static void qcow2_cache_remove(Qcow2Cache *c, int i)
+{
+    int *p;
+
+    if (c->entries[i].offset == 0) {
+        return;
+    }
+
+    p = qcow2_cache_bucket(c, c->entries[i].offset);
+    while (*p != i) {
+        assert(*p != -1);
+        p = &c->entries[*p].next;
+    }
+    *p = c->entries[i].next;
+
+    c->entries[i].offset = 0;
+    c->entries[i].next = -1;
+    c->entries[i].referenced = false;
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -89,8 +149,7 @@ static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 static inline bool can_clean_entry(Qcow2Cache *c, int i)
 {
     Qcow2CachedTable *t = &c->entries[i];
-    return t->ref == 0 && !t->dirty && t->offset != 0 &&
-        t->lru_counter <= c->cache_clean_lru_counter;
+    return t->ref == 0 && !t->dirty && t->offset != 0 && !t->used;
 }
 
 void qcow2_cache_clean_unused(Qcow2Cache *c)
@@ -106,8 +165,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_remove(c, i);
             i++;
             to_clean++;
         }
@@ -117,7 +175,9 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
         }
     }
 
-    c->cache_clean_lru_counter = c->lru_counter;
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].used = false;
+    }
 }
 
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
@@ -125,6 +185,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -137,12 +198,23 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
+    /* At least as many buckets as entries keeps the chains short */
+    c->bucket_bits = MAX(ctz64(pow2ceil(num_tables)), 1);
+    c->buckets = g_try_new(int, 1 << c->bucket_bits);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->table_array || !c->buckets) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->buckets);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].next = -1;
+    }
+    for (i = 0; i < 1 << c->bucket_bits; i++) {
+        c->buckets[i] = -1;
     }
 
     return c;
@@ -158,6 +230,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
 
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->buckets);
     g_free(c);
 
     return 0;
@@ -309,13 +382,13 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        qcow2_cache_remove(c, i);
+        c->entries[i].used = false;
     }
 
     qcow2_cache_table_release(c, 0, c->size);
 
-    c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
@@ -325,11 +398,8 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                    void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
-    int i;
+    int i, n;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,29 +414,37 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
+    i = qcow2_cache_lookup(c, offset);
+    if (i != -1) {
+        goto found;
+    }
+
+    /*
+     * Advance the clock hand to the first unused entry that was not
+     * referenced since the hand last passed it.  Two rounds are enough
+     * to find one if any entry is unused.
+     */
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[c->clock_hand];
+
+        i = c->clock_hand;
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
         }
-        if (++i == c->size) {
-            i = 0;
+        if (t->ref == 0 && !t->referenced) {
+            break;
         }
-    } while (i != lookup_index);
+        t->referenced = false;
+        i = -1;
+    }
 
-    if (min_lru_index == -1) {
+    if (i == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -377,7 +455,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_remove(c, i);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,11 +468,13 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_insert(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
+    c->entries[i].used = true;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -422,10 +502,6 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
     c->entries[i].ref--;
     *table = NULL;
 
-    if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
-    }
-
     assert(c->entries[i].ref >= 0);
 }
 
@@ -438,14 +514,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i == -1 ? NULL : qcow2_cache_get_table_addr(c, i);
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,8 +525,7 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_remove(c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
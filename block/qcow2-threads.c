@@ -34,6 +34,7 @@
 #endif
 
 #include "qcow2.h"
+#include "block/aio_task.h"
 #include "block/block-io.h"
 #include "block/thread-pool.h"
 #include "crypto.h"
@@ -45,7 +46,7 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
+    while (s->nb_threads >= s->max_threads) {
         qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
     }
     s->nb_threads++;
@@ -352,6 +353,88 @@ qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
     return arg.ret;
 }
 
+#ifdef CONFIG_ZSTD
+/*
+ * Clusters larger than this are compressed as several zstd frames in
+ * parallel.  qcow2_zstd_decompress() reads frames until the cluster is
+ * complete, so this needs nothing special on the read side.
+ */
+#define QCOW2_ZSTD_FRAME_SIZE (256 * KiB)
+
+typedef struct Qcow2ZstdFrameTask {
+    AioTask task;
+    BlockDriverState *bs;
+    void *dest;
+    size_t dest_size;
+    const void *src;
+    size_t src_size;
+    ssize_t *ret;
+} Qcow2ZstdFrameTask;
+
+static int coroutine_fn qcow2_zstd_frame_task_entry(AioTask *task)
+{
+    Qcow2ZstdFrameTask *t = container_of(task, Qcow2ZstdFrameTask, task);
+
+    *t->ret = qcow2_co_do_compress(t->bs, t->dest, t->dest_size,
+                                   t->src, t->src_size, qcow2_zstd_compress);
+
+    return *t->ret < 0 ? *t->ret : 0;
+}
+
+static ssize_t coroutine_fn
+qcow2_co_zstd_compress_frames(BlockDriverState *bs,
+                              void *dest, size_t dest_size,
+                              const void *src, size_t src_size)
+{
+    size_t nb_frames = DIV_ROUND_UP(src_size, QCOW2_ZSTD_FRAME_SIZE);
+    /*
+     * Give every frame room for its worst case, so that a frame which does
+     * not shrink can still be made up for by the others.  Only the total
+     * has to fit into @dest.
+     */
+    size_t frame_bound = ZSTD_compressBound(QCOW2_ZSTD_FRAME_SIZE);
+    g_autofree ssize_t *frame_len = g_new(ssize_t, nb_frames);
+    g_autofree uint8_t *buf = g_malloc(nb_frames * frame_bound);
+    AioTaskPool *aio = aio_task_pool_new(nb_frames);
+    size_t i, len = 0;
+    int ret;
+
+    for (i = 0; i < nb_frames; i++) {
+        Qcow2ZstdFrameTask *t = g_new(Qcow2ZstdFrameTask, 1);
+        size_t start = i * QCOW2_ZSTD_FRAME_SIZE;
+        size_t frame_size = MIN(src_size - start, QCOW2_ZSTD_FRAME_SIZE);
+
+        *t = (Qcow2ZstdFrameTask) {
+            .task.func = qcow2_zstd_frame_task_entry,
+            .bs = bs,
+            .dest = buf + i * frame_bound,
+            .dest_size = ZSTD_compressBound(frame_size),
+            .src = (const uint8_t *)src + start,
+            .src_size = frame_size,
+            .ret = &frame_len[i],
+        };
+        aio_task_pool_start_task(aio, &t->task);
+    }
+
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    aio_task_pool_free(aio);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < nb_frames; i++) {
+        if (frame_len[i] > dest_size - len) {
+            return -ENOMEM;
+        }
+        memcpy((uint8_t *)dest + len, buf + i * frame_bound, frame_len[i]);
+        len += frame_len[i];
+    }
+
+    return len;
+}
+#endif
+
 /*
  * qcow2_co_compress()
  *
@@ -378,6 +461,10 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 
 #ifdef CONFIG_ZSTD
     case QCOW2_COMPRESSION_TYPE_ZSTD:
+        if (src_size > QCOW2_ZSTD_FRAME_SIZE) {
+            return qcow2_co_zstd_compress_frames(bs, dest, dest_size,
+                                                 src, src_size);
+        }
         fn = qcow2_zstd_compress;
         break;
 #endif
@@ -701,6 +701,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_DECOMPRESSED_CACHE_SIZE,
     NULL
 };
 
@@ -817,6 +818,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_DECOMPRESSED_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum decompressed cluster cache size, 0 disables it "
+                    "and compressed cluster read-ahead",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -1042,6 +1049,19 @@ static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     return true;
 }
 
+static void qcow2_decompressed_cache_free(BDRVQcow2State *s)
+{
+    for (int i = 0; i < s->decompressed_size; i++) {
+        qemu_vfree(s->decompressed[i].buf);
+    }
+    g_free(s->decompressed);
+    s->decompressed = NULL;
+    s->decompressed_size = 0;
+    s->readahead_next = 0;
+    s->readahead_end = 0;
+    s->readahead_window = 0;
+}
+
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
@@ -1051,6 +1071,7 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    int decompressed_size; /* Number of decompressed cluster cache entries */
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1063,6 +1084,7 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t decompressed_cache_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1151,6 +1173,17 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    /* 0 disables the decompressed cluster cache, and read-ahead with it */
+    decompressed_cache_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_DECOMPRESSED_CACHE_SIZE,
+                          DEFAULT_DECOMPRESSED_CACHE_SIZE);
+    if (decompressed_cache_size) {
+        decompressed_cache_size /= s->cluster_size;
+        r->decompressed_size = MIN(MAX(decompressed_cache_size,
+                                       MIN_DECOMPRESSED_CACHE_SIZE),
+                                   MAX_DECOMPRESSED_CACHE_SIZE);
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1327,6 +1360,14 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->cache_clean_interval = r->cache_clean_interval;
     cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
 
+    /* Nothing uses the entries, the node is drained or being opened */
+    if (s->decompressed_size != r->decompressed_size) {
+        qcow2_decompressed_cache_free(s);
+        s->decompressed_size = r->decompressed_size;
+        s->decompressed = g_new0(Qcow2DecompressedCluster,
+                                 s->decompressed_size);
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1971,6 +2012,13 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MIN(MAX((int)g_get_num_processors(), QCOW2_MIN_THREADS),
+                         QCOW2_MAX_THREADS);
+    QSIMPLEQ_INIT(&s->compressed_writes);
+    qemu_co_queue_init(&s->compressed_write_queue);
+
+    qemu_co_mutex_init(&s->decompressed_lock);
+    qemu_co_queue_init(&s->decompressed_queue);
 
     return ret;
 
@@ -1998,6 +2046,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     if (s->refcount_block_cache) {
         qcow2_cache_destroy(s->refcount_block_cache);
     }
+    qcow2_decompressed_cache_free(s);
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     return ret;
@@ -2893,6 +2942,8 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
 
+    qcow2_decompressed_cache_free(s);
+
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
@@ -4760,6 +4811,384 @@ fail:
     return ret;
 }
 
+/*
+ * Decompressed cluster cache
+ *
+ * Guests often read compressed clusters in pieces smaller than a cluster,
+ * and booting from a compressed image mostly reads it sequentially.  Keep
+ * the last few decompressed clusters, keyed by the host offset of their
+ * compressed data, and decompress the next clusters ahead of time when
+ * reads move forward through the image.
+ */
+
+static Qcow2DecompressedCluster *
+qcow2_decompressed_find(BDRVQcow2State *s, uint64_t coffset)
+{
+    for (int i = 0; i < s->decompressed_size; i++) {
+        Qcow2DecompressedCluster *e = &s->decompressed[i];
+
+        if (e->coffset == coffset && !e->invalid) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the least recently used entry that is not loading, if any */
+static Qcow2DecompressedCluster *
+qcow2_decompressed_evict(BDRVQcow2State *s)
+{
+    Qcow2DecompressedCluster *victim = NULL;
+
+    for (int i = 0; i < s->decompressed_size; i++) {
+        Qcow2DecompressedCluster *e = &s->decompressed[i];
+
+        if (e->loading) {
+            continue;
+        }
+        if (!e->coffset) {
+            return e;
+        }
+        if (!victim || e->lru_counter < victim->lru_counter) {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Forget the cached cluster whose compressed data was at @coffset, because
+ * new compressed data was just allocated there.
+ */
+static void coroutine_fn qcow2_co_decompressed_drop(BlockDriverState *bs,
+                                                    uint64_t coffset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *e;
+
+    qemu_co_mutex_lock(&s->decompressed_lock);
+    e = qcow2_decompressed_find(s, coffset);
+    if (e && e->loading) {
+        e->invalid = true;
+    } else if (e) {
+        e->coffset = 0;
+    }
+    qemu_co_mutex_unlock(&s->decompressed_lock);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed(BlockDriverState *bs, uint64_t coffset, int csize,
+                         uint8_t *out_buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint8_t *buf;
+    int ret;
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    if (ret == 0 &&
+        qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        ret = -EIO;
+    }
+
+    g_free(buf);
+    return ret;
+}
+
+/*
+ * Get the compressed cluster described by @l2_entry into the cache, and
+ * copy @bytes of it starting at @offset_in_cluster to @qiov, unless @qiov
+ * is NULL.
+ *
+ * Returns -EAGAIN without reading anything if all entries are loading.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_decompressed_read(BlockDriverState *bs, uint64_t l2_entry,
+                           int offset_in_cluster, uint64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *e;
+    uint64_t coffset;
+    int csize, ret;
+
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+
+    qemu_co_mutex_lock(&s->decompressed_lock);
+    while ((e = qcow2_decompressed_find(s, coffset)) && e->loading) {
+        if (!qiov) {
+            /* Read-ahead of a cluster that is already being read */
+            qemu_co_mutex_unlock(&s->decompressed_lock);
+            return 0;
+        }
+        qemu_co_queue_wait(&s->decompressed_queue, &s->decompressed_lock);
+    }
+
+    if (e) {
+        if (qiov) {
+            qemu_iovec_from_buf(qiov, qiov_offset, e->buf + offset_in_cluster,
+                                bytes);
+        }
+        e->lru_counter = ++s->decompressed_lru_counter;
+        qemu_co_mutex_unlock(&s->decompressed_lock);
+        return 0;
+    }
+
+    e = qcow2_decompressed_evict(s);
+    if (!e) {
+        qemu_co_mutex_unlock(&s->decompressed_lock);
+        return -EAGAIN;
+    }
+    e->coffset = coffset;
+    e->loading = true;
+    e->invalid = false;
+    if (!e->buf) {
+        e->buf = qemu_blockalign(bs, s->cluster_size);
+    }
+    qemu_co_mutex_unlock(&s->decompressed_lock);
+
+    ret = qcow2_co_read_compressed(bs, coffset, csize, e->buf);
+
+    qemu_co_mutex_lock(&s->decompressed_lock);
+    if (ret == 0 && qiov) {
+        qemu_iovec_from_buf(qiov, qiov_offset, e->buf + offset_in_cluster,
+                            bytes);
+    }
+    if (ret < 0 || e->invalid) {
+        e->coffset = 0;
+        e->invalid = false;
+    }
+    e->loading = false;
+    e->lru_counter = ++s->decompressed_lru_counter;
+    qemu_co_queue_restart_all(&s->decompressed_queue);
+    qemu_co_mutex_unlock(&s->decompressed_lock);
+
+    return ret;
+}
+
+typedef struct Qcow2Readahead {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2Readahead;
+
+static void coroutine_fn qcow2_readahead_entry(void *opaque)
+{
+    Qcow2Readahead *r = opaque;
+    BlockDriverState *bs = r->bs;
+    BDRVQcow2State *s = bs->opaque;
+    QCow2SubclusterType type;
+    unsigned int bytes = s->cluster_size;
+    uint64_t l2_entry;
+    int ret;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_get_host_offset(bs, r->offset, &bytes, &l2_entry, &type);
+        qemu_co_mutex_unlock(&s->lock);
+
+        /* Errors are reported by the guest read, if it comes */
+        if (ret == 0 && type == QCOW2_SUBCLUSTER_COMPRESSED) {
+            qcow2_co_decompressed_read(bs, l2_entry, 0, 0, NULL, 0);
+        }
+    }
+
+    bdrv_dec_in_flight(bs);
+    g_free(r);
+}
+
+/*
+ * Called for each read of the compressed cluster at guest offset @offset.
+ * When reads hit consecutive clusters, start decompressing the clusters
+ * after them in the background, doubling the number of clusters read ahead
+ * with each sequential read up to half of the cache.
+ */
+static void coroutine_fn qcow2_co_readahead(BlockDriverState *bs,
+                                            uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t cluster = start_of_cluster(s, offset);
+    uint64_t start, end;
+
+    qemu_co_mutex_lock(&s->decompressed_lock);
+    if (cluster >= s->readahead_next &&
+        cluster < MAX(s->readahead_next + s->cluster_size, s->readahead_end)) {
+        /* The next cluster, or one that parallel requests already reached */
+        s->readahead_window = MIN(MAX(s->readahead_window * 2, 2),
+                                  s->decompressed_size / 2);
+        s->readahead_next = cluster + s->cluster_size;
+    } else if (cluster >= s->readahead_next ||
+               cluster + (s->readahead_window + 1) * s->cluster_size <
+               s->readahead_next) {
+        /* Random access; clusters just behind are still sequential */
+        s->readahead_window = 0;
+        s->readahead_end = 0;
+        s->readahead_next = cluster + s->cluster_size;
+    }
+
+    start = MAX(s->readahead_next, s->readahead_end);
+    end = MIN(s->readahead_next +
+              (uint64_t)s->readahead_window * s->cluster_size,
+              bs->total_sectors << BDRV_SECTOR_BITS);
+    if (start < end) {
+        s->readahead_end = end;
+    }
+    qemu_co_mutex_unlock(&s->decompressed_lock);
+
+    for (; start < end; start += s->cluster_size) {
+        Qcow2Readahead *r = g_new(Qcow2Readahead, 1);
+
+        *r = (Qcow2Readahead) {
+            .bs = bs,
+            .offset = start,
+        };
+        bdrv_inc_in_flight(bs);
+        qemu_coroutine_enter(qemu_coroutine_create(qcow2_readahead_entry, r));
+    }
+}
+
+/* Maximum number of compressed clusters allocated and written at once */
+#define QCOW2_COMPRESSED_BATCH 64
+
+struct Qcow2CompressedWrite {
+    uint64_t offset;
+    void *buf;
+    size_t bytes;
+
+    uint64_t host_offset;
+    int ret;
+    bool done;
+
+    QSIMPLEQ_ENTRY(Qcow2CompressedWrite) next;
+};
+typedef struct Qcow2CompressedWrite Qcow2CompressedWrite;
+
+static int compressed_write_cmp(const void *a, const void *b)
+{
+    const Qcow2CompressedWrite *wa = *(Qcow2CompressedWrite * const *)a;
+    const Qcow2CompressedWrite *wb = *(Qcow2CompressedWrite * const *)b;
+
+    return wa->offset < wb->offset ? -1 : wa->offset > wb->offset;
+}
+
+/*
+ * Allocate and write a batch of queued compressed clusters.  They are
+ * allocated in guest offset order, which packs them next to each other in
+ * the image file, so that runs of them are written with a single request.
+ *
+ * Called with s->lock held; drops it while writing.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+qcow2_co_write_compressed_batch(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedWrite *batch[QCOW2_COMPRESSED_BATCH];
+    QEMUIOVector qiov;
+    int i, j, n = 0;
+    int ret;
+
+    while (n < QCOW2_COMPRESSED_BATCH &&
+           !QSIMPLEQ_EMPTY(&s->compressed_writes)) {
+        batch[n++] = QSIMPLEQ_FIRST(&s->compressed_writes);
+        QSIMPLEQ_REMOVE_HEAD(&s->compressed_writes, next);
+    }
+    qsort(batch, n, sizeof(batch[0]), compressed_write_cmp);
+
+    for (i = 0; i < n; i++) {
+        Qcow2CompressedWrite *w = batch[i];
+
+        w->ret = qcow2_alloc_compressed_cluster_offset(bs, w->offset, w->bytes,
+                                                       &w->host_offset);
+        if (w->ret == 0) {
+            w->ret = qcow2_pre_write_overlap_check(bs, 0, w->host_offset,
+                                                   w->bytes, true);
+        }
+        if (w->ret == 0) {
+            qcow2_co_decompressed_drop(bs, w->host_offset);
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    qemu_iovec_init(&qiov, n);
+    for (i = 0; i < n; i = j) {
+        if (batch[i]->ret < 0) {
+            j = i + 1;
+            continue;
+        }
+
+        qemu_iovec_reset(&qiov);
+        qemu_iovec_add(&qiov, batch[i]->buf, batch[i]->bytes);
+        for (j = i + 1; j < n; j++) {
+            if (batch[j]->ret < 0 ||
+                batch[j]->host_offset != batch[i]->host_offset + qiov.size) {
+                break;
+            }
+            qemu_iovec_add(&qiov, batch[j]->buf, batch[j]->bytes);
+        }
+
+        BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+        ret = bdrv_co_pwritev(s->data_file, batch[i]->host_offset, qiov.size,
+                              &qiov, 0);
+        while (i < j) {
+            batch[i++]->ret = ret;
+        }
+    }
+    qemu_iovec_destroy(&qiov);
+
+    /*
+     * The new L2 entries were visible while the data was being written, so
+     * reads and read-ahead may have cached what was there before.
+     */
+    for (i = 0; i < n; i++) {
+        if (batch[i]->host_offset) {
+            qcow2_co_decompressed_drop(bs, batch[i]->host_offset);
+        }
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    for (i = 0; i < n; i++) {
+        batch[i]->done = true;
+    }
+}
+
+/*
+ * Queue a compressed cluster and wait until it is allocated and written.
+ * One request at a time writes whole batches of queued clusters, so that
+ * clusters compressed in parallel while a batch is being written are
+ * allocated and written together by the next one.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_write_compressed(BlockDriverState *bs, uint64_t offset,
+                          void *buf, size_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedWrite w = {
+        .offset = offset,
+        .buf = buf,
+        .bytes = bytes,
+    };
+
+    qemu_co_mutex_lock(&s->lock);
+    QSIMPLEQ_INSERT_TAIL(&s->compressed_writes, &w, next);
+    while (!w.done) {
+        if (s->compressed_writer) {
+            qemu_co_queue_wait(&s->compressed_write_queue, &s->lock);
+            continue;
+        }
+        s->compressed_writer = true;
+        qcow2_co_write_compressed_batch(bs);
+        s->compressed_writer = false;
+        qemu_co_queue_restart_all(&s->compressed_write_queue);
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return w.ret;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
@@ -4769,7 +5198,6 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
     int ret;
     ssize_t out_len;
     uint8_t *buf, *out_buf;
-    uint64_t cluster_offset;
 
     assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
            (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
@@ -4797,22 +5225,7 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
         goto fail;
     }
 
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
-    }
-
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
-    qemu_co_mutex_unlock(&s->lock);
-    if (ret < 0) {
-        goto fail;
-    }
-
-    BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
-    ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
+    ret = qcow2_co_write_compressed(bs, offset, out_buf, out_len);
     if (ret < 0) {
         goto fail;
     }
@@ -4916,37 +5329,36 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret = 0, csize;
+    int ret, csize;
     uint64_t coffset;
-    uint8_t *buf, *out_buf;
+    uint8_t *out_buf;
     int offset_in_cluster = offset_into_cluster(s, offset);
 
-    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
-
-    buf = g_try_malloc(csize);
-    if (!buf) {
-        return -ENOMEM;
+    ret = -EAGAIN;
+    if (s->decompressed_size) {
+        ret = qcow2_co_decompressed_read(bs, l2_entry, offset_in_cluster,
+                                         bytes, qiov, qiov_offset);
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
-    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
-    if (ret < 0) {
-        goto fail;
-    }
+    if (ret == -EAGAIN) {
+        /* No cache, or it is busy with read-ahead: use a buffer of our own */
+        qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
-    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
-        ret = -EIO;
-        goto fail;
-    }
+        out_buf = qemu_blockalign(bs, s->cluster_size);
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
+        ret = qcow2_co_read_compressed(bs, coffset, csize, out_buf);
+        if (ret == 0) {
+            qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                                bytes);
+        }
 
-fail:
-    qemu_vfree(out_buf);
-    g_free(buf);
+        qemu_vfree(out_buf);
+    }
 
+    /* Only once the guest's own read is done, so that it doesn't queue up */
+    if (ret == 0 && s->decompressed_size) {
+        qcow2_co_readahead(bs, offset);
+    }
     return ret;
 }
 
@@ -117,6 +117,12 @@
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define MIN_REFCOUNT_CACHE_SIZE 4 /* clusters */
 
+/* Read-ahead needs room for at least one cluster besides the one read */
+#define MIN_DECOMPRESSED_CACHE_SIZE 2 /* clusters */
+/* Lookups scan all entries, so keep them few */
+#define MAX_DECOMPRESSED_CACHE_SIZE 64 /* clusters */
+#define DEFAULT_DECOMPRESSED_CACHE_SIZE (4 * MiB)
+
 #ifdef CONFIG_LINUX
 #define DEFAULT_L2_CACHE_MAX_SIZE (32 * MiB)
 #define DEFAULT_CACHE_CLEAN_INTERVAL 600  /* seconds */
@@ -150,6 +156,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_DECOMPRESSED_CACHE_SIZE "decompressed-cache-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,7 +329,24 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Compression and encryption run in the thread pool, with up to one thread
+ * per host CPU but at least QCOW2_MIN_THREADS and at most QCOW2_MAX_THREADS
+ * per image.
+ */
+#define QCOW2_MIN_THREADS 4
+#define QCOW2_MAX_THREADS 64
+
+typedef struct Qcow2DecompressedCluster {
+    /* Host offset of the compressed data, 0 if the entry is unused */
+    uint64_t coffset;
+    uint8_t *buf;
+    /* Being read and decompressed, buf must not be touched */
+    bool loading;
+    /* The compressed data was reallocated while loading */
+    bool invalid;
+    uint64_t lru_counter;
+} Qcow2DecompressedCluster;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -413,6 +437,28 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
+
+    /*
+     * Compressed clusters waiting to be allocated and written, in the order
+     * in which their compression finished.  Protected by lock.
+     */
+    QSIMPLEQ_HEAD(, Qcow2CompressedWrite) compressed_writes;
+    bool compressed_writer;
+    CoQueue compressed_write_queue;
+
+    /*
+     * Recently read compressed clusters, and read-ahead state for
+     * sequential reads of them.  Protected by decompressed_lock.
+     */
+    CoMutex decompressed_lock;
+    CoQueue decompressed_queue;
+    Qcow2DecompressedCluster *decompressed;
+    int decompressed_size;
+    uint64_t decompressed_lru_counter;
+    uint64_t readahead_next;
+    uint64_t readahead_end;
+    int readahead_window;
 
     BdrvChild *data_file;
 
@@ -236,6 +236,15 @@ static inline bool can_use_fpu(const float_status *s)
                   s->float_rounding_mode == float_round_nearest_even);
 }
 
+/* Truncating operations do not depend on the rounding mode. */
+static inline bool can_use_fpu_trunc(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_exception_flags & float_flag_inexact);
+}
+
 /*
  * Hardfloat generation functions. Each operation can have two flavors:
  * either using softfloat primitives (e.g. float32_is_zero_or_normal) for
@@ -2828,6 +2837,19 @@ float32 float16_to_float32(float16 a, bool ieee, float_status *s)
     const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
     FloatParts64 p;
 
+    /*
+     * Widening conversion can never produce inexact results.  Normal
+     * numbers share the same encoding in the IEEE and AHP formats.
+     */
+    if (likely(float16_is_normal(a))) {
+        uint32_t r = (float16_val(a) & 0x7fff) << 13;
+
+        r += (127 - 15) << 23;
+        return make_float32(r | (uint32_t)(float16_val(a) & 0x8000) << 16);
+    } else if (float16_is_zero(a)) {
+        return float32_set_sign(float32_zero, float16_is_neg(a));
+    }
+
     float16a_unpack_canonical(&p, a, s, fmt16);
     parts_float_to_float(&p, s);
     return float32_round_pack_canonical(&p, s);
@@ -2838,6 +2860,15 @@ float64 float16_to_float64(float16 a, bool ieee, float_status *s)
     const FloatFmt *fmt16 = ieee ? &float16_params : &float16_params_ahp;
     FloatParts64 p;
 
+    if (likely(float16_is_normal(a))) {
+        uint64_t r = (uint64_t)(float16_val(a) & 0x7fff) << 42;
+
+        r += (uint64_t)(1023 - 15) << 52;
+        return make_float64(r | (uint64_t)(float16_val(a) & 0x8000) << 48);
+    } else if (float16_is_zero(a)) {
+        return float64_set_sign(float64_zero, float16_is_neg(a));
+    }
+
     float16a_unpack_canonical(&p, a, s, fmt16);
     parts_float_to_float(&p, s);
     return float64_round_pack_canonical(&p, s);
@@ -2901,7 +2932,8 @@ float16 float64_to_float16(float64 a, bool ieee, float_status *s)
     return float16a_round_pack_canonical(&p, s, fmt);
 }
 
-float32 float64_to_float32(float64 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
@@ -2910,10 +2942,43 @@ float32 float64_to_float32(float64 a, float_status *s)
     return float32_round_pack_canonical(&p, s);
 }
 
+float32 float64_to_float32(float64 a, float_status *s)
+{
+    union_float64 ua;
+    union_float32 ur;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float64_input_flush1(&ua.s, s);
+    if (float64_is_zero(ua.s)) {
+        return float32_set_sign(float32_zero, float64_is_neg(ua.s));
+    } else if (unlikely(!float64_is_normal(ua.s))) {
+        goto soft;
+    }
+
+    /* Leave overflow and possible underflow to softfloat. */
+    ur.h = ua.h;
+    if (unlikely(f32_is_inf(ur) || fabsf(ur.h) <= FLT_MIN)) {
+        goto soft;
+    }
+    return ur.s;
+
+ soft:
+    return soft_float64_to_float32(ua.s, s);
+}
+
 float32 bfloat16_to_float32(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
 
+    /* Widening conversion can never produce inexact results.  */
+    if (likely(bfloat16_is_normal(a) || bfloat16_is_zero(a))) {
+        return make_float32((uint32_t)a << 16);
+    }
+
     bfloat16_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
     return float32_round_pack_canonical(&p, s);
@@ -2923,6 +2988,15 @@ float64 bfloat16_to_float64(bfloat16 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (likely(bfloat16_is_normal(a) || bfloat16_is_zero(a))) {
+        union_float32 uf;
+        union_float64 ud;
+
+        uf.s = make_float32((uint32_t)a << 16);
+        ud.h = uf.h;
+        return ud.s;
+    }
+
     bfloat16_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
     return float64_round_pack_canonical(&p, s);
@@ -3070,6 +3144,18 @@ float32 float32_round_to_int(float32 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (can_use_fpu(s)) {
+        union_float32 ua;
+
+        ua.s = a;
+        float32_input_flush1(&ua.s, s);
+        if (likely(float32_is_zero_or_normal(ua.s))) {
+            ua.h = rintf(ua.h);
+            return ua.s;
+        }
+        a = ua.s;
+    }
+
     float32_unpack_canonical(&p, a, s);
     parts_round_to_int(&p, s->float_rounding_mode, 0, s, &float32_params);
     return float32_round_pack_canonical(&p, s);
@@ -3079,6 +3165,18 @@ float64 float64_round_to_int(float64 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (can_use_fpu(s)) {
+        union_float64 ua;
+
+        ua.s = a;
+        float64_input_flush1(&ua.s, s);
+        if (likely(float64_is_zero_or_normal(ua.s))) {
+            ua.h = rint(ua.h);
+            return ua.s;
+        }
+        a = ua.s;
+    }
+
     float64_unpack_canonical(&p, a, s);
     parts_round_to_int(&p, s->float_rounding_mode, 0, s, &float64_params);
     return float64_round_pack_canonical(&p, s);
@@ -3340,6 +3438,40 @@ static int64_t floatx80_to_int64_scalbn(floatx80 a, FloatRoundMode rmode,
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
 
+/*
+ * Hardfloat conversions to integer.  With the inexact flag already set,
+ * the only exception left to detect is invalid, for out of range inputs;
+ * leave those, NaNs and infinities to softfloat.  The host rounds with
+ * round-to-nearest-even, as checked by can_use_fpu(), or truncates.
+ */
+static inline bool f32_to_int_hard(float32 a, bool rtz, float lo, float hi,
+                                   float *r, float_status *s)
+{
+    union_float32 ua;
+
+    ua.s = a;
+    float32_input_flush1(&ua.s, s);
+    if (unlikely(!float32_is_zero_or_normal(ua.s))) {
+        return false;
+    }
+    *r = rtz ? truncf(ua.h) : rintf(ua.h);
+    return *r >= lo && *r < hi;
+}
+
+static inline bool f64_to_int_hard(float64 a, bool rtz, double lo, double hi,
+                                   double *r, float_status *s)
+{
+    union_float64 ua;
+
+    ua.s = a;
+    float64_input_flush1(&ua.s, s);
+    if (unlikely(!float64_is_zero_or_normal(ua.s))) {
+        return false;
+    }
+    *r = rtz ? trunc(ua.h) : rint(ua.h);
+    return *r >= lo && *r < hi;
+}
+
 int8_t float16_to_int8(float16 a, float_status *s)
 {
     return float16_to_int8_scalbn(a, s->float_rounding_mode, 0, s);
@@ -3367,11 +3499,23 @@ int16_t float32_to_int16(float32 a, float_status *s)
 
 int32_t float32_to_int32(float32 a, float_status *s)
 {
+    float r;
+
+    if (can_use_fpu(s) &&
+        f32_to_int_hard(a, false, -0x1p31f, 0x1p31f, &r, s)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float32_to_int64(float32 a, float_status *s)
 {
+    float r;
+
+    if (can_use_fpu(s) &&
+        f32_to_int_hard(a, false, -0x1p63f, 0x1p63f, &r, s)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -3382,11 +3526,23 @@ int16_t float64_to_int16(float64 a, float_status *s)
 
 int32_t float64_to_int32(float64 a, float_status *s)
 {
+    double r;
+
+    if (can_use_fpu(s) &&
+        f64_to_int_hard(a, false, -0x1p31, 0x1p31, &r, s)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float64_to_int64(float64 a, float_status *s)
 {
+    double r;
+
+    if (can_use_fpu(s) &&
+        f64_to_int_hard(a, false, -0x1p63, 0x1p63, &r, s)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -3437,11 +3593,23 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    float r;
+
+    if (can_use_fpu_trunc(s) &&
+        f32_to_int_hard(a, true, -0x1p31f, 0x1p31f, &r, s)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    float r;
+
+    if (can_use_fpu_trunc(s) &&
+        f32_to_int_hard(a, true, -0x1p63f, 0x1p63f, &r, s)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3452,11 +3620,23 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    double r;
+
+    if (can_use_fpu_trunc(s) &&
+        f64_to_int_hard(a, true, -0x1p31, 0x1p31, &r, s)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    double r;
+
+    if (can_use_fpu_trunc(s) &&
+        f64_to_int_hard(a, true, -0x1p63, 0x1p63, &r, s)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
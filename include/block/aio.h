@@ -317,6 +317,18 @@ struct AioContext {
 
     /* Pending callback state for cqe handlers */
     CqeHandlerSimpleQ cqe_handler_ready_list;
+
+    /* Used slots of the registered file and buffer tables, or NULL */
+    unsigned long *io_uring_fixed_files;
+    unsigned long *io_uring_fixed_bufs;
+
+    /*
+     * Ring with 128 byte sqes and 32 byte cqes for IORING_OP_URING_CMD, or
+     * NULL.  It is only created once passthrough commands are used, so that
+     * other requests keep using the smaller entries of fdmon_io_uring.
+     */
+    struct io_uring *io_uring_cmd_ring;
+    CqeHandler io_uring_cmd_poll; /* IORING_OP_POLL_ADD of its ring fd */
 #endif /* CONFIG_LINUX_IO_URING */
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -849,6 +861,15 @@ static inline bool aio_has_io_uring(void)
     return ctx->fdmon_ops->add_sqe;
 }
 
+/**
+ * aio_has_io_uring_cmd: Return whether io_uring supports IORING_OP_URING_CMD
+ * commands that need 128 byte sqes and 32 byte cqes, like NVMe passthrough.
+ *
+ * This creates the ring for these commands in the current AioContext.  Other
+ * AioContexts create theirs when aio_add_sqe_cmd() is first called there.
+ */
+bool aio_has_io_uring_cmd(void);
+
 /**
  * aio_add_sqe: Add an io_uring sqe for submission.
  * @prep_sqe: invoked with an sqe that should be prepared for submission
@@ -869,6 +890,77 @@ static inline bool aio_has_io_uring(void)
  */
 void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
                  void *opaque, CqeHandler *cqe_handler);
+
+/**
+ * aio_add_sqe_cmd: Add a 128 byte sqe for submission.
+ * @prep_sqe: invoked with an sqe that should be prepared for submission
+ * @opaque: user-defined argument to @prep_sqe()
+ * @cqe_handler: the unique cqe handler associated with this request
+ *
+ * Like aio_add_sqe(), but the sqe goes to the separate ring for
+ * IORING_OP_URING_CMD commands.  Only the first 16 bytes of the 32 byte cqe
+ * are copied to @cqe_handler.  If the ring cannot be created, @cqe_handler is
+ * invoked with a negative errno in cqe.res.
+ *
+ * This function must be called only when aio_has_io_uring_cmd() returned
+ * true.
+ */
+void aio_add_sqe_cmd(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                     void *opaque, CqeHandler *cqe_handler);
+
+/**
+ * aio_register_fixed_file: Add a file to the io_uring registered files
+ * @ctx: the AioContext whose io_uring the file is registered with
+ * @fd: the file descriptor
+ *
+ * Sqes submitted by @ctx can then refer to the file by the returned index
+ * together with IOSQE_FIXED_FILE, which saves the kernel from looking up
+ * the file for each request.  The io_uring keeps a reference to the file
+ * until aio_unregister_fixed_file() is called.
+ *
+ * Must be called with the BQL held.
+ *
+ * Returns: the index on success, -errno on failure.
+ */
+int aio_register_fixed_file(AioContext *ctx, int fd);
+
+/**
+ * aio_unregister_fixed_file: Remove a file from the io_uring registered files
+ * @ctx: the AioContext passed to aio_register_fixed_file()
+ * @index: the index returned by aio_register_fixed_file()
+ *
+ * Must be called with the BQL held.
+ */
+void aio_unregister_fixed_file(AioContext *ctx, int index);
+
+/**
+ * aio_register_fixed_bufs: Add buffers to the io_uring registered buffers
+ * @ctx: the AioContext whose io_uring the buffers are registered with
+ * @iov: the buffers, each of them at most 1 GiB
+ * @iovcnt: the number of buffers
+ *
+ * The buffers get consecutive indices starting at the returned one, that
+ * sqes submitted by @ctx can use with IORING_OP_READ_FIXED and
+ * IORING_OP_WRITE_FIXED.  Their memory stays pinned until
+ * aio_unregister_fixed_bufs() is called.
+ *
+ * Must be called with the BQL held.
+ *
+ * Returns: the index of the first buffer on success, -errno on failure.
+ */
+int aio_register_fixed_bufs(AioContext *ctx, const struct iovec *iov,
+                            unsigned iovcnt);
+
+/**
+ * aio_unregister_fixed_bufs: Remove buffers from the io_uring registered
+ * buffers
+ * @ctx: the AioContext passed to aio_register_fixed_bufs()
+ * @index: the index returned by aio_register_fixed_bufs()
+ * @iovcnt: the number of buffers that were registered
+ *
+ * Must be called with the BQL held.
+ */
+void aio_unregister_fixed_bufs(AioContext *ctx, int index, unsigned iovcnt);
 #endif /* CONFIG_LINUX_IO_URING */
 
 #endif
@@ -74,11 +74,46 @@ static inline bool laio_has_fua(void)
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
+typedef struct LuringFixed LuringFixed;
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd,
+                                  LuringFixed *fixed, uint64_t offset,
                                   QEMUIOVector *qiov, int type,
                                   BdrvRequestFlags flags);
 bool luring_has_fua(void);
+
+/*
+ * Registered file and, if @use_bufs, buffers for luring_co_submit().  The
+ * buffers are those passed to luring_fixed_register_buf().
+ */
+LuringFixed *luring_fixed_new(AioContext *ctx, int fd, bool use_bufs);
+void luring_fixed_free(LuringFixed *fixed);
+void luring_fixed_set_fd(LuringFixed *fixed, int fd);
+void luring_fixed_detach_aio_context(LuringFixed *fixed);
+void luring_fixed_attach_aio_context(LuringFixed *fixed, AioContext *ctx);
+bool luring_fixed_register_buf(LuringFixed *fixed, void *host, size_t size,
+                               Error **errp);
+void luring_fixed_unregister_buf(LuringFixed *fixed, void *host, size_t size);
+
+/* NVMe namespace behind a generic char device (/dev/ngXnY) */
+typedef struct LuringNvme {
+    uint32_t nsid;          /* 0 if the file is not such a device */
+    unsigned lba_shift;
+    uint64_t nsze;          /* in logical blocks */
+    uint32_t max_transfer;  /* in bytes, from MDTS */
+    unsigned max_segments;  /* of the namespace's queue, 0 if unknown */
+} LuringNvme;
+
+/*
+ * luring_nvme_probe: fill @nvme if @fd is an NVMe generic char device, whose
+ * reads, writes and flushes must then go through luring_co_submit_nvme().
+ * Returns 0 on success, including for other files, or -errno.
+ */
+int luring_nvme_probe(int fd, LuringNvme *nvme, Error **errp);
+int coroutine_fn luring_co_submit_nvme(BlockDriverState *bs, int fd,
+                                       const LuringNvme *nvme,
+                                       uint64_t offset, QEMUIOVector *qiov,
+                                       int type, BdrvRequestFlags flags);
 #else
 static inline bool luring_has_fua(void)
 {
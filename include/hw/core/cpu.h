@@ -207,6 +207,12 @@ typedef uint32_t MMUIdxMap;
 /* Use a fully associative victim tlb of 8 entries. */
 #define CPU_VTLB_SIZE 8
 
+/*
+ * Number of page or range flushes requested by other cpus that may be
+ * queued before they are merged into a flush of the whole mmu_idx.
+ */
+#define CPU_TLB_PENDING_SIZE 16
+
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
  * so the layout is not as critical as that of CPUTLBEntry. This is
@@ -296,6 +302,17 @@ typedef struct CPUTLBDesc {
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+/*
+ * A page or range flush of a set of mmu_idx.
+ * See tlb_flush_range_by_mmuidx for the meaning of the fields.
+ */
+typedef struct TLBFlushRangeData {
+    vaddr addr;
+    vaddr len;
+    MMUIdxMap idxmap;
+    unsigned bits;
+} TLBFlushRangeData;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -308,6 +325,16 @@ typedef struct CPUTLBCommon {
      * Protected by tlb_c.lock.
      */
     MMUIdxMap dirty;
+    /*
+     * Flushes requested by other cpus that have not been performed yet.
+     * They are coalesced into a single work item on this cpu.  When
+     * pending[] is full, further requests flush the whole of each
+     * mmu_idx in pending_full instead.  Protected by pending_lock.
+     */
+    QemuSpin pending_lock;
+    MMUIdxMap pending_full;
+    unsigned pending_n;
+    TLBFlushRangeData pending[CPU_TLB_PENDING_SIZE];
     /*
      * Statistics.  These are not lock protected, but are read and
      * written atomically.  This allows the monitor to print a snapshot
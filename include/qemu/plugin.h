@@ -71,8 +71,11 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_COND,
     PLUGIN_CB_MEM_REGULAR,
+    PLUGIN_CB_MEM_TRACE,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
+    PLUGIN_CB_INLINE_MIN_U64,
+    PLUGIN_CB_INLINE_MAX_U64,
 };
 
 struct qemu_plugin_regular_cb {
@@ -97,6 +100,11 @@ struct qemu_plugin_conditional_cb {
     uint64_t imm;
 };
 
+struct qemu_plugin_mem_trace_cb {
+    struct qemu_plugin_mem_trace *trace;
+    enum qemu_plugin_mem_rw rw;
+};
+
 /*
  * A dynamic callback has an insertion point that is determined at run-time.
  * Usually the insertion point is somewhere in the code cache; think for
@@ -108,6 +116,7 @@ struct qemu_plugin_dyn_cb {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
         struct qemu_plugin_inline_cb inline_insn;
+        struct qemu_plugin_mem_trace_cb mem_trace;
     };
 };
 
@@ -129,6 +138,23 @@ struct qemu_plugin_scoreboard {
     QLIST_ENTRY(qemu_plugin_scoreboard) entry;
 };
 
+/*
+ * A memory trace keeps one buffer per vcpu in a scoreboard: each entry
+ * is a qemu_plugin_mem_trace_buf holding up to n_records records.
+ */
+struct qemu_plugin_mem_trace {
+    struct qemu_plugin_scoreboard *score;
+    size_t n_records;
+    qemu_plugin_vcpu_mem_trace_cb_t cb;
+    void *userdata;
+    QLIST_ENTRY(qemu_plugin_mem_trace) entry;
+};
+
+struct qemu_plugin_mem_trace_buf {
+    uint64_t len;
+    qemu_plugin_mem_record records[];
+};
+
 /* Internal context for this TranslationBlock */
 struct qemu_plugin_tb {
     GPtrArray *insns;
@@ -175,6 +201,8 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_high,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw);
 
+void plugin_mem_trace_flush(unsigned int vcpu_index, void *trace);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
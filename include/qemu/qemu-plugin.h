@@ -72,11 +72,16 @@ typedef uint64_t qemu_plugin_id_t;
  * - added qemu_plugin_write_memory_hwaddr
  * - added qemu_plugin_write_register
  * - added qemu_plugin_translate_vaddr
+ *
+ * version 6:
+ * - added QEMU_PLUGIN_INLINE_MIN_U64 and QEMU_PLUGIN_INLINE_MAX_U64
+ * - added qemu_plugin_mem_trace_new, qemu_plugin_mem_trace_free,
+ *   qemu_plugin_mem_trace_flush and qemu_plugin_register_vcpu_mem_trace
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 5
+#define QEMU_PLUGIN_VERSION 6
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -303,6 +308,8 @@ struct qemu_plugin_tb;
 struct qemu_plugin_insn;
 /** struct qemu_plugin_scoreboard - Opaque handle for a scoreboard */
 struct qemu_plugin_scoreboard;
+/** struct qemu_plugin_mem_trace - Opaque handle for a memory trace */
+struct qemu_plugin_mem_trace;
 
 /**
  * typedef qemu_plugin_u64 - uint64_t member of an entry in a scoreboard
@@ -450,11 +457,17 @@ void qemu_plugin_register_vcpu_tb_exec_cond_cb(struct qemu_plugin_tb *tb,
  *
  * @QEMU_PLUGIN_INLINE_ADD_U64: add an immediate value uint64_t
  * @QEMU_PLUGIN_INLINE_STORE_U64: store an immediate value uint64_t
+ * @QEMU_PLUGIN_INLINE_MIN_U64: store the unsigned minimum of the entry and
+ *                              an immediate value uint64_t
+ * @QEMU_PLUGIN_INLINE_MAX_U64: store the unsigned maximum of the entry and
+ *                              an immediate value uint64_t
  */
 
 enum qemu_plugin_op {
     QEMU_PLUGIN_INLINE_ADD_U64,
     QEMU_PLUGIN_INLINE_STORE_U64,
+    QEMU_PLUGIN_INLINE_MIN_U64,
+    QEMU_PLUGIN_INLINE_MAX_U64,
 };
 
 /**
@@ -765,6 +778,98 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * typedef qemu_plugin_mem_record - a recorded memory access
+ * @vaddr: the virtual address of the access
+ * @info: the memory transaction handle, see qemu_plugin_mem_*
+ * @value: the value loaded or stored, zero-extended to 64 bits; for
+ *   16 byte accesses, its low 64 bits
+ * @value_high: the high 64 bits of the value of 16 byte accesses,
+ *   undefined for smaller accesses
+ */
+typedef struct {
+    uint64_t vaddr;
+    qemu_plugin_meminfo_t info;
+    uint64_t value;
+    uint64_t value_high;
+} qemu_plugin_mem_record;
+
+/**
+ * typedef qemu_plugin_vcpu_mem_trace_cb_t - memory trace batch callback
+ * @vcpu_index: the executing vCPU
+ * @records: the accesses recorded by @vcpu_index, oldest first
+ * @n_records: the number of valid entries in @records
+ * @userdata: any user data provided when creating the trace
+ *
+ * @records is only valid for the duration of the callback.
+ */
+typedef void (*qemu_plugin_vcpu_mem_trace_cb_t)(
+    unsigned int vcpu_index,
+    const qemu_plugin_mem_record *records,
+    size_t n_records,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_trace_new() - allocate a memory trace
+ * @n_records: number of records buffered per vCPU
+ * @cb: callback receiving the buffered records
+ * @userdata: any user data to pass to @cb
+ *
+ * A memory trace is a per-vCPU buffer into which the translated code
+ * writes one qemu_plugin_mem_record per instrumented memory access,
+ * without calling out of the code cache. @cb is called once a vCPU's
+ * buffer is full, when the vCPU goes idle or exits, and by
+ * qemu_plugin_mem_trace_flush(). Buffers are not flushed at the end of
+ * each translation block, which would take a helper call per block.
+ *
+ * The trace must be freed before the plugin is uninstalled.
+ *
+ * Returns a handle to the new trace, to pass to
+ * qemu_plugin_register_vcpu_mem_trace().
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_mem_trace *qemu_plugin_mem_trace_new(
+    size_t n_records,
+    qemu_plugin_vcpu_mem_trace_cb_t cb,
+    void *userdata);
+
+/**
+ * qemu_plugin_mem_trace_free() - free a memory trace
+ * @trace: trace to free
+ *
+ * Records still buffered are discarded.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_trace_free(struct qemu_plugin_mem_trace *trace);
+
+/**
+ * qemu_plugin_mem_trace_flush() - pass buffered records to the callback
+ * @trace: trace to flush
+ * @vcpu_index: vCPU whose buffer is flushed
+ *
+ * Calls the trace callback for any records buffered by @vcpu_index,
+ * e.g. from a vCPU exit or atexit callback. Must not be called while
+ * @vcpu_index is running.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_mem_trace_flush(struct qemu_plugin_mem_trace *trace,
+                                 unsigned int vcpu_index);
+
+/**
+ * qemu_plugin_register_vcpu_mem_trace() - record memory accesses in a trace
+ * @insn: handle for instruction to instrument
+ * @rw: record reads, writes or both
+ * @trace: trace to record into
+ *
+ * This records every memory access generated by the instruction into
+ * @trace. This is much cheaper than a callback per access with
+ * qemu_plugin_register_vcpu_mem_cb().
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_trace(struct qemu_plugin_insn *insn,
+                                         enum qemu_plugin_mem_rw rw,
+                                         struct qemu_plugin_mem_trace *trace);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
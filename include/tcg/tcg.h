@@ -702,6 +702,31 @@ void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
  */
 size_t tcg_nb_tbs(void);
 
+/**
+ * tcg_nb_regions:
+ *
+ * Returns: the number of regions code_gen_buffer is divided into.
+ */
+size_t tcg_nb_regions(void);
+
+/**
+ * tcg_nb_regions_used:
+ *
+ * Returns: the number of regions handed out to TCG contexts since the
+ * last flush.  Once all regions are in use, the next region allocation
+ * triggers a flush.
+ */
+size_t tcg_nb_regions_used(void);
+
+/**
+ * tcg_region_nb_tbs:
+ * @region_idx: index of the region, less than tcg_nb_regions()
+ *
+ * Returns: the number of translation blocks in the region tree of
+ * region @region_idx.
+ */
+size_t tcg_region_nb_tbs(size_t region_idx);
+
 /* user-mode: Called with mmap_lock held.  */
 static inline void *tcg_malloc(int size)
 {
@@ -243,6 +243,16 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, ", zerocopy_fallbacks=%" PRIu64,
                            info->ram->dirty_sync_missed_zero_copy);
         }
+        if (info->ram->dirty_sync_count) {
+            monitor_printf(mon, ", last_sync_us=%" PRIu64 "+%" PRIu64,
+                           info->ram->dirty_sync_log_time,
+                           info->ram->dirty_sync_bitmap_time);
+        }
+        if (info->ram->zero_scan_time) {
+            monitor_printf(mon, ", zero_scan_mbps=%0.2f",
+                           info->ram->zero_scan_bytes * 8.0 /
+                           info->ram->zero_scan_time);
+        }
         monitor_printf(mon, "\n");
     }
 
@@ -50,6 +50,16 @@ typedef struct {
      * Number of times we have synchronized guest bitmaps.
      */
     Stat64 dirty_sync_count;
+    /*
+     * Time in microseconds spent by the last sync collecting the dirty
+     * log from the accelerator.
+     */
+    Stat64 dirty_sync_log_time;
+    /*
+     * Time in microseconds spent by the last sync merging the dirty log
+     * into the migration bitmaps.
+     */
+    Stat64 dirty_sync_bitmap_time;
     /*
      * Number of times zero copy failed to send any page using zero
      * copy.
@@ -101,6 +111,16 @@ typedef struct {
      * Number of pages transferred that were full of zeros.
      */
     Stat64 zero_pages;
+    /*
+     * Number of bytes checked by multifd zero page detection, on either
+     * side of the migration.
+     */
+    Stat64 zero_scan_bytes;
+    /*
+     * Time in nanoseconds spent by multifd zero page detection, summed
+     * over all channels.
+     */
+    Stat64 zero_scan_time;
 } MigrationAtomicStats;
 
 extern MigrationAtomicStats mig_stats;
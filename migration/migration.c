@@ -1276,6 +1276,13 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_log_time =
+        stat64_get(&mig_stats.dirty_sync_log_time);
+    info->ram->dirty_sync_bitmap_time =
+        stat64_get(&mig_stats.dirty_sync_bitmap_time);
+    info->ram->zero_scan_bytes = stat64_get(&mig_stats.zero_scan_bytes);
+    info->ram->zero_scan_time =
+        stat64_get(&mig_stats.zero_scan_time) / SCALE_US;
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
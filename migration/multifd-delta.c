@@ -0,0 +1,437 @@
+/*
+ * Multifd delta compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zstd.h>
+#include "qemu/bswap.h"
+#include "qemu/rcu.h"
+#include "system/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+#include "xbzrle.h"
+
+/*
+ * Pages are encoded against the contents they had when they were last
+ * sent, which is also what the destination holds in guest memory, so
+ * only the source needs to cache them.  A page is never in flight on two
+ * channels at once, because the dirty bitmap is only synced again after
+ * the multifd channels are synced.
+ *
+ * Each page in a packet becomes a record: a 32-bit big endian length
+ * followed by that many bytes.  A length equal to the page size is a
+ * full page; anything shorter is an XBZRLE delta to apply to the page
+ * the destination already has (0 meaning unchanged).  The records of a
+ * packet are then compressed together with zstd.
+ */
+#define DELTA_RECORD_HDR    4
+
+/*
+ * Each channel caches the pages it sent in a direct-mapped cache of its
+ * own.  Pages are not sent on a fixed channel though, so a channel may
+ * only use its copy if it was also the last one to send the page.  This
+ * is tracked in a map shared by all channels, with the channel id + 1
+ * of the last sender of every page, or 0 if the destination's copy is
+ * not in any cache.  Only the channel sending a page accesses its entry.
+ */
+static QemuMutex delta_owner_lock;
+static uint8_t *delta_owner;
+static unsigned int delta_owner_users;
+
+struct delta_data {
+    /* stream for compression */
+    ZSTD_CStream *zcs;
+    /* stream for decompression */
+    ZSTD_DStream *zds;
+    /* buffers */
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    /* copy of the page being encoded */
+    uint8_t *page;
+    /* records of the current packet */
+    uint8_t *buf;
+    /* size of records buffer */
+    uint32_t buf_len;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+    /* number of pages in the cache */
+    uint64_t cache_slots;
+    /* RAM page number + 1 of the page in each slot, 0 if empty */
+    uint64_t *cache_tags;
+    /* cached pages */
+    uint8_t *cache;
+};
+
+static uint32_t multifd_delta_buf_len(void)
+{
+    return multifd_ram_page_count() *
+           (multifd_ram_page_size() + DELTA_RECORD_HDR);
+}
+
+static void multifd_delta_owner_get(void)
+{
+    uint32_t page_size = multifd_ram_page_size();
+    ram_addr_t end = 0;
+    RAMBlock *block;
+
+    QEMU_LOCK_GUARD(&delta_owner_lock);
+    if (delta_owner_users++) {
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            end = MAX(end, block->offset + block->max_length);
+        }
+    }
+    delta_owner = g_new0(uint8_t, DIV_ROUND_UP(end, page_size));
+}
+
+static void multifd_delta_owner_put(void)
+{
+    QEMU_LOCK_GUARD(&delta_owner_lock);
+    if (!--delta_owner_users) {
+        g_free(delta_owner);
+        delta_owner = NULL;
+    }
+}
+
+static uint64_t multifd_delta_page(RAMBlock *block, ram_addr_t offset)
+{
+    return (block->offset + offset) / multifd_ram_page_size();
+}
+
+/* Zero pages are sent without going through the cache */
+static void multifd_delta_cache_forget(RAMBlock *block, ram_addr_t offset)
+{
+    qatomic_set(&delta_owner[multifd_delta_page(block, offset)], 0);
+}
+
+/*
+ * Write the record for the page at @offset of @block to @dst, and make
+ * the page's current contents the base for its next delta.
+ *
+ * Returns the size of the record.
+ */
+static uint32_t multifd_delta_encode_page(MultiFDSendParams *p,
+                                          RAMBlock *block, ram_addr_t offset,
+                                          uint8_t *dst)
+{
+    struct delta_data *z = p->compress_data;
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t page = multifd_delta_page(block, offset);
+    uint64_t slot = page % z->cache_slots;
+    uint8_t *cached = z->cache + slot * page_size;
+    int len = -1;
+
+    /* The guest can keep writing to the page; encode a stable copy */
+    memcpy(z->page, block->host + offset, page_size);
+
+    if (z->cache_tags[slot] == page + 1 &&
+        qatomic_read(&delta_owner[page]) == p->id + 1) {
+        len = xbzrle_encode_buffer(cached, z->page, page_size,
+                                   dst + DELTA_RECORD_HDR, page_size - 1);
+    }
+    memcpy(cached, z->page, page_size);
+    z->cache_tags[slot] = page + 1;
+    qatomic_set(&delta_owner[page], p->id + 1);
+
+    if (len < 0) {
+        memcpy(dst + DELTA_RECORD_HDR, z->page, page_size);
+        len = page_size;
+    }
+    stl_be_p(dst, len);
+    return DELTA_RECORD_HDR + len;
+}
+
+/* Multifd delta compression */
+
+static int multifd_delta_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct delta_data *z = g_new0(struct delta_data, 1);
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t pages = migrate_xbzrle_cache_size() / page_size;
+    int res;
+
+    z->zcs = ZSTD_createCStream();
+    if (!z->zcs) {
+        g_free(z);
+        error_setg(errp, "multifd %u: zstd createCStream failed", p->id);
+        return -1;
+    }
+
+    res = ZSTD_initCStream(z->zcs, migrate_multifd_zstd_level());
+    if (ZSTD_isError(res)) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z);
+        error_setg(errp, "multifd %u: initCStream failed with error %s",
+                   p->id, ZSTD_getErrorName(res));
+        return -1;
+    }
+
+    z->page = g_malloc(multifd_ram_page_size());
+    z->buf_len = multifd_delta_buf_len();
+    z->buf = g_malloc(z->buf_len);
+    /* This is the maximum size of the compressed buffer */
+    z->zbuff_len = ZSTD_compressBound(z->buf_len);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z->page);
+        g_free(z->buf);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    /* xbzrle-cache-size is the total for all channels */
+    z->cache_slots = MAX(pages / migrate_multifd_channels(), 1);
+    z->cache_tags = g_new0(uint64_t, z->cache_slots);
+    z->cache = g_malloc(z->cache_slots * page_size);
+    p->compress_data = z;
+
+    multifd_delta_owner_get();
+
+    /* Needs 2 IOVs, one for packet header and one for compressed data */
+    p->iov = g_new0(struct iovec, 2);
+    return 0;
+}
+
+static void multifd_delta_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct delta_data *z = p->compress_data;
+
+    multifd_delta_owner_put();
+
+    ZSTD_freeCStream(z->zcs);
+    z->zcs = NULL;
+    g_free(z->page);
+    z->page = NULL;
+    g_free(z->buf);
+    z->buf = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(z->cache_tags);
+    z->cache_tags = NULL;
+    g_free(z->cache);
+    z->cache = NULL;
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static int multifd_delta_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct delta_data *z = p->compress_data;
+    bool has_normal = multifd_send_prepare_common(p);
+    uint32_t len = 0;
+    size_t ret;
+    uint32_t i;
+
+    for (i = pages->normal_num; i < pages->num; i++) {
+        multifd_delta_cache_forget(pages->block, pages->offset[i]);
+    }
+
+    if (!has_normal) {
+        goto out;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        len += multifd_delta_encode_page(p, pages->block, pages->offset[i],
+                                         z->buf + len);
+    }
+
+    z->in.src = z->buf;
+    z->in.size = len;
+    z->in.pos = 0;
+    z->out.dst = z->zbuff;
+    z->out.size = z->zbuff_len;
+    z->out.pos = 0;
+
+    /* zbuff is large enough to flush all the records in one go */
+    ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, ZSTD_e_flush);
+    if (ZSTD_isError(ret)) {
+        error_setg(errp, "multifd %u: compressStream error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        return -1;
+    }
+    if (ret > 0 || z->in.pos < z->in.size) {
+        error_setg(errp, "multifd %u: compressStream buffer too small",
+                   p->id);
+        return -1;
+    }
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = z->out.pos;
+    p->iovs_num++;
+    p->next_packet_size = z->out.pos;
+
+out:
+    p->flags |= MULTIFD_FLAG_DELTA;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_delta_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct delta_data *z = g_new0(struct delta_data, 1);
+    int ret;
+
+    p->compress_data = z;
+    z->zds = ZSTD_createDStream();
+    if (!z->zds) {
+        g_free(z);
+        error_setg(errp, "multifd %u: zstd createDStream failed", p->id);
+        return -1;
+    }
+
+    ret = ZSTD_initDStream(z->zds);
+    if (ZSTD_isError(ret)) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z);
+        error_setg(errp, "multifd %u: initDStream failed with error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        return -1;
+    }
+
+    z->buf_len = multifd_delta_buf_len();
+    z->buf = g_malloc(z->buf_len);
+    z->zbuff_len = ZSTD_compressBound(z->buf_len);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z->buf);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+static void multifd_delta_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct delta_data *z = p->compress_data;
+
+    ZSTD_freeDStream(z->zds);
+    z->zds = NULL;
+    g_free(z->buf);
+    z->buf = NULL;
+    g_free(z->zbuff);
+    z->zbuff = NULL;
+    g_free(p->compress_data);
+    p->compress_data = NULL;
+}
+
+static int multifd_delta_recv(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    struct delta_data *z = p->compress_data;
+    uint32_t pos = 0;
+    size_t zret;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_DELTA) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_DELTA);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size %u larger than %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+
+    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    z->in.src = z->zbuff;
+    z->in.size = in_size;
+    z->in.pos = 0;
+    z->out.dst = z->buf;
+    z->out.size = z->buf_len;
+    z->out.pos = 0;
+
+    do {
+        zret = ZSTD_decompressStream(z->zds, &z->out, &z->in);
+        if (ZSTD_isError(zret)) {
+            error_setg(errp, "multifd %u: decompressStream returned %s",
+                       p->id, ZSTD_getErrorName(zret));
+            return -1;
+        }
+    } while (z->in.pos < z->in.size && z->out.pos < z->out.size);
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *host = p->host + p->normal[i];
+        uint32_t len;
+
+        if (pos + DELTA_RECORD_HDR > z->out.pos) {
+            break;
+        }
+        len = ldl_be_p(z->buf + pos);
+        pos += DELTA_RECORD_HDR;
+        if (len > page_size || pos + len > z->out.pos) {
+            error_setg(errp, "multifd %u: bad record length %u for page %d",
+                       p->id, len, i);
+            return -1;
+        }
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (len == page_size) {
+            memcpy(host, z->buf + pos, page_size);
+        } else if (xbzrle_decode_buffer(z->buf + pos, len,
+                                        host, page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode delta for page %d",
+                       p->id, i);
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (i != p->normal_num || pos != z->out.pos) {
+        error_setg(errp, "multifd %u: packet size received %u size expected %u",
+                   p->id, (uint32_t)z->out.pos, pos);
+        return -1;
+    }
+    return 0;
+}
+
+static const MultiFDMethods multifd_delta_ops = {
+    .send_setup = multifd_delta_send_setup,
+    .send_cleanup = multifd_delta_send_cleanup,
+    .send_prepare = multifd_delta_send_prepare,
+    .recv_setup = multifd_delta_recv_setup,
+    .recv_cleanup = multifd_delta_recv_cleanup,
+    .recv = multifd_delta_recv
+};
+
+static void multifd_delta_register(void)
+{
+    qemu_mutex_init(&delta_owner_lock);
+    multifd_register_ops(MULTIFD_COMPRESSION_DELTA, &multifd_delta_ops);
+}
+
+migration_init(multifd_delta_register);
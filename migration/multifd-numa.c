@@ -0,0 +1,138 @@
+/*
+ * Multifd NUMA-aware channel assignment
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "hw/boards.h"
+#include "system/hostmem.h"
+#include "system/numa.h"
+#include "system/ramblock.h"
+#include "options.h"
+#include "multifd.h"
+#include "trace.h"
+
+#ifdef CONFIG_NUMA
+#include <numa.h>
+#endif
+
+/*
+ * With x-multifd-numa, channel @id carries the pages of the memory
+ * backend of guest NUMA node (@id % nb_nodes).  Both sides derive the
+ * assignment from the guest NUMA configuration, which has to match for
+ * migration to succeed anyway, so nothing needs to be negotiated:
+ *
+ *  - the source steers each RAM packet to a channel of the node whose
+ *    memdev backs the packet's RAMBlock;
+ *
+ *  - the destination pins each receive thread to the host CPUs of the
+ *    host nodes its guest node is bound to, so that pages are written
+ *    (and first touched) from the local node.
+ *
+ * Pages of RAMBlocks that do not belong to a node memdev are sent on
+ * any channel.
+ */
+
+static int multifd_numa_nodes(void)
+{
+    MachineState *ms = current_machine;
+
+    if (!migrate_multifd_numa() || !ms->numa_state) {
+        return 0;
+    }
+
+    /* Every node needs at least a channel of its own */
+    if (ms->numa_state->num_nodes < 2 ||
+        ms->numa_state->num_nodes > migrate_multifd_channels()) {
+        return 0;
+    }
+    return ms->numa_state->num_nodes;
+}
+
+int multifd_numa_block_node(MultiFDNumaCache *cache, RAMBlock *block)
+{
+    NodeInfo *nodes;
+    int nb_nodes = multifd_numa_nodes();
+
+    if (!nb_nodes) {
+        return -1;
+    }
+
+    /* Packets rarely change block */
+    if (block == cache->block) {
+        return cache->node;
+    }
+
+    nodes = current_machine->numa_state->nodes;
+    cache->block = block;
+    cache->node = -1;
+    for (int i = 0; i < nb_nodes; i++) {
+        if (nodes[i].node_memdev && block->mr == &nodes[i].node_memdev->mr) {
+            cache->node = i;
+            break;
+        }
+    }
+    return cache->node;
+}
+
+bool multifd_numa_channel_match(int id, int node)
+{
+    return id % multifd_numa_nodes() == node;
+}
+
+void multifd_numa_recv_pin(QemuThread *thread, int id)
+{
+#ifdef CONFIG_NUMA
+    int nb_nodes = multifd_numa_nodes();
+    HostMemoryBackend *backend;
+    struct bitmask *tmp_cpus;
+    unsigned long *bitmap;
+    unsigned long host_node;
+    int nbits, ret, i;
+
+    if (!nb_nodes || numa_available() < 0) {
+        return;
+    }
+
+    backend = current_machine->numa_state->nodes[id % nb_nodes].node_memdev;
+    if (!backend || backend->policy == HOST_MEM_POLICY_DEFAULT ||
+        bitmap_empty(backend->host_nodes, MAX_NODES)) {
+        return;
+    }
+
+    nbits = numa_num_possible_cpus();
+    bitmap = bitmap_new(nbits);
+    tmp_cpus = numa_allocate_cpumask();
+    host_node = find_first_bit(backend->host_nodes, MAX_NODES);
+    while (host_node < MAX_NODES) {
+        numa_bitmask_clearall(tmp_cpus);
+        /* Ignore errors such as nodes without CPUs */
+        if (!numa_node_to_cpus(host_node, tmp_cpus)) {
+            for (i = 0; i < nbits; i++) {
+                if (numa_bitmask_isbitset(tmp_cpus, i)) {
+                    set_bit(i, bitmap);
+                }
+            }
+        }
+        host_node = find_next_bit(backend->host_nodes, MAX_NODES,
+                                  host_node + 1);
+    }
+    numa_free_cpumask(tmp_cpus);
+
+    if (!bitmap_empty(bitmap, nbits)) {
+        /* Returns a positive errno, or -ENOSYS if unsupported */
+        ret = abs(qemu_thread_set_affinity(thread, bitmap, nbits));
+        if (ret) {
+            warn_report("multifd: failed to pin receive channel %d: %s",
+                        id, strerror(ret));
+        } else {
+            trace_multifd_numa_recv_pin(id, id % nb_nodes);
+        }
+    }
+    g_free(bitmap);
+#endif
+}
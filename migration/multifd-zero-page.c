@@ -12,6 +12,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
+#include "qemu/timer.h"
 #include "system/ramblock.h"
 #include "migration.h"
 #include "migration-stats.h"
@@ -24,17 +26,58 @@ static bool multifd_zero_page_enabled(void)
     return migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD;
 }
 
-static void swap_page_offset(ram_addr_t *pages_offset, int a, int b)
+/**
+ * multifd_zero_page_scan: Find the zero pages in a batch of pages.
+ *
+ * Sets bit i of @zero if the page at @host + @offset[i] is all zeroes,
+ * and clears it otherwise.  The start, middle and end of the next page,
+ * which are the first bytes checked, are prefetched while scanning the
+ * current one.
+ *
+ * Returns the number of zero pages.
+ *
+ * @param host The host address of the pages' RAMBlock.
+ * @param offset The offsets of the pages in the RAMBlock.
+ * @param num The number of pages.
+ * @param zero The bitmap of zero pages, of at least @num bits.
+ */
+static uint32_t multifd_zero_page_scan(uint8_t *host, ram_addr_t *offset,
+                                       uint32_t num, unsigned long *zero)
 {
-    ram_addr_t temp;
+    size_t page_size = multifd_ram_page_size();
+    int64_t start = get_clock();
+    uint32_t zero_num = 0;
 
-    if (a == b) {
-        return;
+    /*
+     * Target pages are never smaller than 512 bytes (TARGET_PAGE_BITS_MIN
+     * in page-vary-target.c), which is all that buffer_is_zero_ge256()
+     * needs, so the small buffer checks of buffer_is_zero() are skipped.
+     */
+    assert(page_size >= 256);
+
+    for (uint32_t i = 0; i < num; i++) {
+        const char *page = (const char *)host + offset[i];
+
+        if (i + 1 < num) {
+            const char *next = (const char *)host + offset[i + 1];
+
+            __builtin_prefetch(next);
+            __builtin_prefetch(next + page_size / 2);
+            __builtin_prefetch(next + page_size - 1);
+        }
+
+        if (buffer_is_zero_sample3(page, page_size) &&
+            buffer_is_zero_ge256(page, page_size)) {
+            set_bit(i, zero);
+            zero_num++;
+        } else {
+            clear_bit(i, zero);
+        }
     }
 
-    temp = pages_offset[a];
-    pages_offset[a] = pages_offset[b];
-    pages_offset[b] = temp;
+    stat64_add(&mig_stats.zero_scan_bytes, (uint64_t)num * page_size);
+    stat64_add(&mig_stats.zero_scan_time, get_clock() - start);
+    return zero_num;
 }
 
 /**
@@ -49,32 +92,41 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     RAMBlock *rb = pages->block;
-    int i = 0;
-    int j = pages->num - 1;
+    unsigned long *zero = p->zero_bitmap;
+    uint32_t i, k;
 
     if (!multifd_zero_page_enabled()) {
         pages->normal_num = pages->num;
         goto out;
     }
 
+    pages->normal_num = pages->num -
+        multifd_zero_page_scan(rb->host, pages->offset, pages->num, zero);
+
     /*
      * Sort the page offset array by moving all normal pages to
      * the left and all zero pages to the right of the array.
      */
-    while (i <= j) {
-        uint64_t offset = pages->offset[i];
+    for (i = 0, k = pages->normal_num; i < pages->normal_num; i++) {
+        ram_addr_t temp;
 
-        if (!buffer_is_zero(rb->host + offset, multifd_ram_page_size())) {
-            i++;
+        if (!test_bit(i, zero)) {
             continue;
         }
-
-        swap_page_offset(pages->offset, i, j);
-        ram_release_page(rb->idstr, offset);
-        j--;
+        /* Find a normal page among the ones past normal_num */
+        while (test_bit(k, zero)) {
+            ram_release_page(rb->idstr, pages->offset[k]);
+            k++;
+        }
+        ram_release_page(rb->idstr, pages->offset[i]);
+        temp = pages->offset[i];
+        pages->offset[i] = pages->offset[k];
+        pages->offset[k] = temp;
+        k++;
+    }
+    for (; k < pages->num; k++) {
+        ram_release_page(rb->idstr, pages->offset[k]);
     }
-
-    pages->normal_num = i;
 
 out:
     stat64_add(&mig_stats.normal_pages, pages->normal_num);
@@ -83,7 +135,11 @@ out:
 
 void multifd_recv_zero_page_process(MultiFDRecvParams *p)
 {
-    for (int i = 0; i < p->zero_num; i++) {
+    bool postcopy = migrate_postcopy_ram();
+    uint32_t rewrite_num = 0;
+    uint32_t i;
+
+    for (i = 0; i < p->zero_num; i++) {
         void *page = p->host + p->zero[i];
         bool received =
                 ramblock_recv_bitmap_test_byte_offset(p->block, p->zero[i]);
@@ -102,11 +158,29 @@ void multifd_recv_zero_page_process(MultiFDRecvParams *p)
          * When postcopy is enabled, always write the zero page as and when
          * it is migrated.
          */
-        if (migrate_postcopy_ram() || received) {
+        if (postcopy) {
             memset(page, 0, multifd_ram_page_size());
+        } else if (received) {
+            /* Collect them at the start of p->zero, it is not used later */
+            p->zero[rewrite_num++] = p->zero[i];
         }
         if (!received) {
             ramblock_recv_bitmap_set_offset(p->block, p->zero[i]);
         }
     }
+
+    /*
+     * Pages migrated more than once are often zero already, e.g. when
+     * the guest freed them; avoid dirtying them again.
+     */
+    if (!rewrite_num ||
+        rewrite_num == multifd_zero_page_scan(p->host, p->zero, rewrite_num,
+                                              p->zero_bitmap)) {
+        return;
+    }
+    for (i = 0; i < rewrite_num; i++) {
+        if (!test_bit(i, p->zero_bitmap)) {
+            memset(p->host + p->zero[i], 0, multifd_ram_page_size());
+        }
+    }
 }
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitmap.h"
 #include "qemu/cutils.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
@@ -79,6 +80,8 @@ struct {
     int exiting;
     /* multifd ops */
     const MultiFDMethods *ops;
+    /* RAMBlock to NUMA node lookup, protected by multifd_send_mutex */
+    MultiFDNumaCache numa_cache;
 } *multifd_send_state;
 
 struct {
@@ -348,6 +351,9 @@ static void multifd_send_kick_main(MultiFDSendParams *p)
  * Switching is safe because both the migration thread and the channel
  * thread have barriers in place to serialize access.
  *
+ * With x-multifd-numa, RAM pages of a guest NUMA node's memory backend
+ * only go to the channels assigned to that node.
+ *
  * Returns true if succeed, false otherwise.
  */
 bool multifd_send(MultiFDSendData **send_data)
@@ -356,6 +362,8 @@ bool multifd_send(MultiFDSendData **send_data)
     static int next_channel;
     MultiFDSendParams *p = NULL; /* make happy gcc */
     MultiFDSendData *tmp;
+    int node = -1;
+    int tokens = 1, scanned = 0;
 
     if (multifd_send_should_exit()) {
         return false;
@@ -363,6 +371,11 @@ bool multifd_send(MultiFDSendData **send_data)
 
     QEMU_LOCK_GUARD(&multifd_send_state->multifd_send_mutex);
 
+    if ((*send_data)->type == MULTIFD_PAYLOAD_RAM) {
+        node = multifd_numa_block_node(&multifd_send_state->numa_cache,
+                                       (*send_data)->u.ram.block);
+    }
+
     /* We wait here, until at least one channel is ready */
     qemu_sem_wait(&multifd_send_state->channels_ready);
 
@@ -381,10 +394,22 @@ bool multifd_send(MultiFDSendData **send_data)
          * Lockless read to p->pending_job is safe, because only multifd
          * sender thread can clear it.
          */
-        if (qatomic_read(&p->pending_job) == false) {
+        if ((node < 0 || multifd_numa_channel_match(i, node)) &&
+            qatomic_read(&p->pending_job) == false) {
             next_channel = (i + 1) % migrate_multifd_channels();
             break;
         }
+        if (node >= 0 && ++scanned == migrate_multifd_channels()) {
+            /* Only channels of other nodes are idle, wait for one more */
+            qemu_sem_wait(&multifd_send_state->channels_ready);
+            tokens++;
+            scanned = 0;
+        }
+    }
+
+    /* Give back the tokens of the idle channels we skipped */
+    while (--tokens) {
+        qemu_sem_post(&multifd_send_state->channels_ready);
     }
 
     /*
@@ -552,6 +577,7 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     g_clear_pointer(&p->packet_device_state, g_free);
     g_free(p->packet);
     p->packet = NULL;
+    g_clear_pointer(&p->zero_bitmap, g_free);
     multifd_send_state->ops->send_cleanup(p, errp);
     assert(!p->iov);
 
@@ -960,6 +986,7 @@ bool multifd_send_setup(void)
             p->packet_device_state->hdr.version = cpu_to_be32(MULTIFD_VERSION);
         }
         p->name = g_strdup_printf(MIGRATION_THREAD_SRC_MULTIFD, i);
+        p->zero_bitmap = bitmap_new(page_count);
         p->write_flags = 0;
 
         if (!multifd_new_send_channel_create(p, &local_err)) {
@@ -1141,6 +1168,7 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
     p->normal = NULL;
     g_free(p->zero);
     p->zero = NULL;
+    g_clear_pointer(&p->zero_bitmap, g_free);
     multifd_recv_state->ops->recv_cleanup(p);
 }
 
@@ -1492,6 +1520,7 @@ int multifd_recv_setup(Error **errp)
         p->name = g_strdup_printf(MIGRATION_THREAD_DST_MULTIFD, i);
         p->normal = g_new0(ram_addr_t, page_count);
         p->zero = g_new0(ram_addr_t, page_count);
+        p->zero_bitmap = bitmap_new(page_count);
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -1562,5 +1591,6 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
     p->thread_created = true;
     qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
                        QEMU_THREAD_JOINABLE);
+    multifd_numa_recv_pin(&p->thread, id);
     qatomic_inc(&multifd_recv_state->count);
 }
@@ -57,12 +57,17 @@ MultiFDRecvData *multifd_get_recv_data(void);
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
-/* We reserve 5 bits for compression methods */
+/*
+ * We reserve 5 bits for compression methods.  The field holds one
+ * enumerated method code rather than a set of bits: the values are
+ * compared as a whole, so MULTIFD_FLAG_DELTA is unrelated to ZLIB|ZSTD.
+ */
 #define MULTIFD_FLAG_COMPRESSION_MASK (0x1f << 1)
 /* we need to be compatible. Before compression value was 0 */
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_DELTA (3 << 1)
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
@@ -232,6 +237,8 @@ typedef struct {
     struct iovec *iov;
     /* number of iovs used */
     uint32_t iovs_num;
+    /* zero pages found by multifd_send_zero_page_detect() */
+    unsigned long *zero_bitmap;
     /* used for compression methods */
     void *compress_data;
 }  MultiFDSendParams;
@@ -291,6 +298,8 @@ typedef struct {
     ram_addr_t *zero;
     /* num of zero pages */
     uint32_t zero_num;
+    /* zero pages found by multifd_recv_zero_page_process() */
+    unsigned long *zero_bitmap;
     /* used for de-compression methods */
     void *compress_data;
     /* Flags for the QIOChannel */
@@ -382,6 +391,16 @@ bool multifd_send_prepare_common(MultiFDSendParams *p);
 void multifd_send_zero_page_detect(MultiFDSendParams *p);
 void multifd_recv_zero_page_process(MultiFDRecvParams *p);
 
+/* Node of the last RAMBlock looked up, per migration */
+typedef struct {
+    RAMBlock *block;
+    int node;
+} MultiFDNumaCache;
+
+int multifd_numa_block_node(MultiFDNumaCache *cache, RAMBlock *block);
+bool multifd_numa_channel_match(int id, int node);
+void multifd_numa_recv_pin(QemuThread *thread, int id);
+
 void multifd_channel_connect(MultiFDSendParams *p, QIOChannel *ioc);
 bool multifd_send(MultiFDSendData **send_data);
 MultiFDSendData *multifd_send_data_alloc(void);
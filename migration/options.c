@@ -203,6 +203,7 @@ const Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-multifd-numa", MIGRATION_CAPABILITY_X_MULTIFD_NUMA),
 };
 const size_t migration_properties_count = ARRAY_SIZE(migration_properties);
 
@@ -283,6 +284,13 @@ bool migrate_multifd(void)
     return s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_multifd_numa(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_MULTIFD_NUMA];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s = migrate_get_current();
@@ -638,6 +646,14 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_X_MULTIFD_NUMA]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Capability 'x-multifd-numa' requires capability "
+                             "'multifd'");
+            return false;
+        }
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp,
@@ -1181,6 +1197,21 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+#ifdef CONFIG_ZSTD
+    /*
+     * Legacy zero page detection sends pages outside of multifd, behind
+     * the back of the delta cache.
+     */
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_DELTA &&
+        params->has_zero_page_detection &&
+        params->zero_page_detection == ZERO_PAGE_DETECTION_LEGACY) {
+        error_setg(errp, "Multifd delta compression is not compatible with "
+                   "legacy zero page detection");
+        return false;
+    }
+#endif
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
@@ -0,0 +1,269 @@
+/*
+ * Migration outcome prediction
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <math.h>
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+#include "qemu/cutils.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "qapi/qapi-visit-migration.h"
+#include "system/ramblock.h"
+#include "exec/target_page.h"
+#include "options.h"
+#include "ram.h"
+
+/* Number of guest pages looked at, spread over RAMBlocks by size */
+#define PREDICT_SAMPLE_PAGES        1024
+/* Give up on convergence after that many precopy iterations */
+#define PREDICT_MAX_ITERATIONS      30
+
+typedef struct {
+    uint64_t ram_bytes;
+    /* Fraction of zero pages */
+    double zero_ratio;
+    /* Compressed size over original size, for non-zero pages */
+    double ratio[MULTIFD_COMPRESSION__MAX];
+    /* Bytes compressed per second by one thread, 0 if not limited */
+    double throughput[MULTIFD_COMPRESSION__MAX];
+} MigrationSample;
+
+/* Copy the sampled pages, returns the number of non-zero ones */
+static size_t migration_sample_pages(MigrationSample *s, uint8_t *buf)
+{
+    size_t page_size = qemu_target_page_size();
+    size_t sampled = 0, nonzero = 0;
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        s->ram_bytes += block->used_length;
+    }
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        uint64_t pages = block->used_length / page_size;
+        uint64_t n = DIV_ROUND_UP(PREDICT_SAMPLE_PAGES * block->used_length,
+                                  s->ram_bytes);
+
+        for (; n && pages && sampled < PREDICT_SAMPLE_PAGES; n--, sampled++) {
+            /* Cover blocks of more than INT32_MAX pages uniformly too */
+            uint64_t page = MIN((uint64_t)(g_random_double() * pages),
+                                pages - 1);
+            uint8_t *host = block->host + page * page_size;
+
+            /* Don't populate memory that was discarded, it reads as zero */
+            if (ramblock_page_is_discarded(block, page * page_size)) {
+                continue;
+            }
+            if (!buffer_is_zero(host, page_size)) {
+                memcpy(buf + nonzero * page_size, host, page_size);
+                nonzero++;
+            }
+        }
+    }
+
+    s->zero_ratio = sampled ? (double)(sampled - nonzero) / sampled : 0;
+    return nonzero;
+}
+
+static void migration_sample_compression(MigrationSample *s, uint8_t *buf,
+                                         size_t pages)
+{
+    size_t page_size = qemu_target_page_size();
+    size_t bound = MAX(compressBound(page_size), page_size);
+    g_autofree uint8_t *out = NULL;
+    uint64_t zlib_bytes = 0, zstd_bytes = 0;
+    int64_t zlib_time, zstd_time = 0;
+    size_t i;
+
+    for (i = 0; i < MULTIFD_COMPRESSION__MAX; i++) {
+        s->ratio[i] = 1;
+    }
+    if (!pages) {
+        return;
+    }
+
+#ifdef CONFIG_ZSTD
+    bound = MAX(bound, ZSTD_compressBound(page_size));
+#endif
+    out = g_malloc(bound);
+
+    zlib_time = get_clock();
+    for (i = 0; i < pages; i++) {
+        uLongf len = bound;
+
+        if (compress2(out, &len, buf + i * page_size, page_size,
+                      migrate_multifd_zlib_level()) != Z_OK) {
+            len = page_size;
+        }
+        zlib_bytes += len;
+    }
+    zlib_time = get_clock() - zlib_time;
+
+#ifdef CONFIG_ZSTD
+    zstd_time = get_clock();
+    for (i = 0; i < pages; i++) {
+        size_t len = ZSTD_compress(out, bound, buf + i * page_size, page_size,
+                                   migrate_multifd_zstd_level());
+
+        zstd_bytes += ZSTD_isError(len) ? page_size : len;
+    }
+    zstd_time = get_clock() - zstd_time;
+#endif
+
+    s->ratio[MULTIFD_COMPRESSION_ZLIB] =
+        (double)zlib_bytes / (pages * page_size);
+    s->throughput[MULTIFD_COMPRESSION_ZLIB] =
+        (double)pages * page_size * NANOSECONDS_PER_SECOND / MAX(zlib_time, 1);
+#ifdef CONFIG_ZSTD
+    s->ratio[MULTIFD_COMPRESSION_ZSTD] =
+        (double)zstd_bytes / (pages * page_size);
+    s->throughput[MULTIFD_COMPRESSION_ZSTD] =
+        (double)pages * page_size * NANOSECONDS_PER_SECOND / MAX(zstd_time, 1);
+#endif
+}
+
+/*
+ * Simulate precopy iterations: each one sends what the previous one left
+ * dirty, while the guest dirties memory at @dirty_rate.  The first
+ * iteration sends all of RAM, including zero pages; later ones are
+ * assumed to only send pages with data.
+ */
+static MigrationPrediction *
+migration_predict(MigrationPredictionConfig *config, MigrationSample *s,
+                  double bandwidth, double downtime_limit, double dirty_rate)
+{
+    MigrationPrediction *pred = g_new0(MigrationPrediction, 1);
+    MultiFDCompression method = config->has_multifd_compression ?
+        config->multifd_compression : MULTIFD_COMPRESSION_NONE;
+    double remaining = s->ram_bytes, time = 0, transferred = 0;
+    double downtime = 0;
+    double cpu_rate = INFINITY;
+    uint32_t iter;
+
+    if (s->throughput[method]) {
+        cpu_rate = config->multifd_channels * s->throughput[method];
+    }
+
+    for (iter = 1; iter <= PREDICT_MAX_ITERATIONS; iter++) {
+        /* Bytes on the wire for each byte of guest RAM */
+        double wire = s->ratio[method] * (iter == 1 ? 1 - s->zero_ratio : 1);
+        /* Bytes of guest RAM sent per second */
+        double rate = MIN(wire ? bandwidth / wire : INFINITY, cpu_rate);
+        double elapsed = remaining / rate;
+        double dirty = MIN(dirty_rate * elapsed, s->ram_bytes);
+
+        time += elapsed;
+        transferred += remaining * wire;
+        wire = s->ratio[method];
+        rate = MIN(wire ? bandwidth / wire : INFINITY, cpu_rate);
+
+        if (config->has_postcopy_after && iter >= config->postcopy_after) {
+            /* The rest is pulled by the destination while the guest runs */
+            pred->converges = true;
+            time += dirty / rate;
+            transferred += dirty * wire;
+            break;
+        }
+        if (dirty / rate <= downtime_limit) {
+            pred->converges = true;
+            downtime = dirty / rate;
+            time += downtime;
+            transferred += dirty * wire;
+            break;
+        }
+        remaining = dirty;
+    }
+
+    pred->config = QAPI_CLONE(MigrationPredictionConfig, config);
+    pred->iterations = MIN(iter, PREDICT_MAX_ITERATIONS);
+    pred->transferred = transferred;
+    if (pred->converges) {
+        pred->has_total_time = true;
+        pred->total_time = time * 1000;
+        pred->has_downtime = true;
+        pred->downtime = downtime * 1000;
+    }
+    return pred;
+}
+
+MigrationPredictionList *
+qmp_query_migrate_prediction(uint64_t bandwidth, bool has_downtime_limit,
+                             uint64_t downtime_limit,
+                             MigrationPredictionConfigList *configs,
+                             Error **errp)
+{
+    MigrationPredictionList *head = NULL, **tail = &head;
+    MigrationPredictionConfigList *l;
+    g_autoptr(DirtyRateInfo) info = NULL;
+    g_autofree uint8_t *buf = NULL;
+    MigrationSample s = { 0 };
+    double limit;
+    size_t pages;
+
+    for (l = configs; l; l = l->next) {
+        MigrationPredictionConfig *config = l->value;
+        MultiFDCompression method = config->has_multifd_compression ?
+            config->multifd_compression : MULTIFD_COMPRESSION_NONE;
+
+        if (method != MULTIFD_COMPRESSION_NONE &&
+            !config->has_multifd_channels) {
+            error_setg(errp, "Compression requires multifd-channels");
+            return NULL;
+        }
+        if (method != MULTIFD_COMPRESSION_NONE &&
+            method != MULTIFD_COMPRESSION_ZLIB
+#ifdef CONFIG_ZSTD
+            && method != MULTIFD_COMPRESSION_ZSTD
+#endif
+            ) {
+            error_setg(errp, "Cannot predict multifd-compression '%s'",
+                       MultiFDCompression_str(method));
+            return NULL;
+        }
+        if (config->has_multifd_channels && !config->multifd_channels) {
+            error_setg(errp, "multifd-channels must be at least 1");
+            return NULL;
+        }
+    }
+
+    if (!bandwidth) {
+        error_setg(errp, "bandwidth must be greater than 0");
+        return NULL;
+    }
+
+    info = qmp_query_dirty_rate(false, TIME_UNIT_SECOND, errp);
+    if (!info) {
+        return NULL;
+    }
+    if (info->status != DIRTY_RATE_STATUS_MEASURED) {
+        error_setg(errp, "Dirty rate is not measured, run calc-dirty-rate "
+                   "first");
+        return NULL;
+    }
+
+    buf = g_malloc(PREDICT_SAMPLE_PAGES * qemu_target_page_size());
+    pages = migration_sample_pages(&s, buf);
+    migration_sample_compression(&s, buf, pages);
+
+    limit = has_downtime_limit ? downtime_limit : migrate_downtime_limit();
+    for (l = configs; l; l = l->next) {
+        QAPI_LIST_APPEND(tail,
+                         migration_predict(l->value, &s, bandwidth,
+                                           limit / 1000,
+                                           (double)info->dirty_rate * MiB));
+    }
+    return head;
+}
@@ -32,6 +32,7 @@
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "block/thread-pool.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -435,6 +436,8 @@ struct RAMState {
      * Protected by @bitmap_mutex.
      */
     PageLocationHint page_hint;
+    /* Workers for migration_bitmap_sync(), created on first use */
+    ThreadPool *sync_threads;
 };
 typedef struct RAMState RAMState;
 
@@ -1022,6 +1025,122 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Large RAMBlocks are synced in parallel, in chunks of at least
+ * RAM_SYNC_CHUNK_PAGES_MIN pages.  Chunks are also a multiple of one
+ * word of clear_bmap, so that workers never write to the same word of
+ * either rb->bmap or rb->clear_bmap.
+ */
+#define RAM_SYNC_CHUNK_PAGES_MIN    (1UL << 20)
+#define RAM_SYNC_THREADS_MAX        16
+
+typedef struct RAMSyncChunk {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t num_dirty;
+} RAMSyncChunk;
+
+static ram_addr_t ramblock_sync_chunk_size(RAMBlock *rb)
+{
+    uint64_t pages = MAX(RAM_SYNC_CHUNK_PAGES_MIN,
+                         (uint64_t)BITS_PER_LONG << rb->clear_bmap_shift);
+
+    /*
+     * physical_memory_sync_dirty_bitmap() only takes its word-based path,
+     * which has no side effects outside the block, for aligned blocks.
+     */
+    if (!rb->clear_bmap ||
+        (rb->offset >> TARGET_PAGE_BITS) % BITS_PER_LONG) {
+        return 0;
+    }
+    return pages << TARGET_PAGE_BITS;
+}
+
+static int ramblock_sync_chunk(void *opaque)
+{
+    RAMSyncChunk *chunk = opaque;
+
+    /*
+     * The migration thread is in an RCU critical section until all
+     * chunks are done, so the RAMBlock and the dirty memory blocks
+     * cannot go away under us.
+     */
+    chunk->num_dirty = physical_memory_sync_dirty_bitmap(chunk->rb,
+                                                         chunk->start,
+                                                         chunk->length);
+    return 0;
+}
+
+/*
+ * Sync the dirty bitmap of all RAMBlocks, splitting large blocks across
+ * a pool of worker threads.  Called with RCU critical section and
+ * bitmap_mutex held.
+ */
+static void ramblock_sync_dirty_bitmap_all(RAMState *rs)
+{
+    g_autofree RAMSyncChunk *chunks = NULL;
+    size_t nr_chunks = 0, i = 0;
+    long host_procs;
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t size = ramblock_sync_chunk_size(block);
+
+        if (size) {
+            nr_chunks += block->used_length / size;
+        }
+    }
+
+    host_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nr_chunks < 2 || host_procs < 2) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    if (!rs->sync_threads) {
+        rs->sync_threads = thread_pool_new();
+    }
+    thread_pool_set_max_threads(rs->sync_threads,
+                                MIN(MIN(nr_chunks, host_procs),
+                                    RAM_SYNC_THREADS_MAX));
+
+    chunks = g_new(RAMSyncChunk, nr_chunks);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t size = ramblock_sync_chunk_size(block);
+        ram_addr_t start = 0;
+
+        for (; size && start + size <= block->used_length; start += size) {
+            chunks[i] = (RAMSyncChunk) {
+                .rb = block, .start = start, .length = size,
+            };
+            thread_pool_submit(rs->sync_threads, ramblock_sync_chunk,
+                               &chunks[i], NULL);
+            i++;
+        }
+
+        /* The unaligned tail, and small blocks, are done right here */
+        if (start < block->used_length) {
+            uint64_t new_dirty_pages =
+                physical_memory_sync_dirty_bitmap(block, start,
+                                                  block->used_length - start);
+
+            rs->migration_dirty_pages += new_dirty_pages;
+            rs->num_dirty_pages_period += new_dirty_pages;
+        }
+    }
+    assert(i == nr_chunks);
+
+    thread_pool_wait(rs->sync_threads);
+
+    for (i = 0; i < nr_chunks; i++) {
+        rs->migration_dirty_pages += chunks[i].num_dirty;
+        rs->num_dirty_pages_period += chunks[i].num_dirty;
+    }
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1143,8 +1262,8 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
+    int64_t start_us, log_us;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
@@ -1153,17 +1272,20 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     }
 
     trace_migration_bitmap_sync_start();
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     memory_global_dirty_log_sync(last_stage);
+    log_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
-            }
+            ramblock_sync_dirty_bitmap_all(rs);
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
     }
 
+    stat64_set(&mig_stats.dirty_sync_log_time, log_us - start_us);
+    stat64_set(&mig_stats.dirty_sync_bitmap_time,
+               qemu_clock_get_us(QEMU_CLOCK_REALTIME) - log_us);
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
@@ -2432,6 +2554,7 @@ static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
         migration_page_queue_free(*rsp);
+        g_clear_pointer(&(*rsp)->sync_threads, thread_pool_free);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
         g_free(*rsp);
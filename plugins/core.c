@@ -304,10 +304,34 @@ void qemu_plugin_vcpu_init_hook(CPUState *cpu)
     async_run_on_cpu(cpu, qemu_plugin_vcpu_init__async, RUN_ON_CPU_NULL);
 }
 
+/*
+ * Deliver the records of @cpu before it stops running code.
+ *
+ * Like the flushes of full buffers, which run from the vCPU without any
+ * lock, callbacks are invoked with plugin.lock released: the lock only
+ * protects the list of traces, and each buffer is only used by its vCPU.
+ */
+static void plugin_mem_trace_flush_vcpu(CPUState *cpu)
+{
+    g_autoptr(GPtrArray) traces = g_ptr_array_new();
+    struct qemu_plugin_mem_trace *trace;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_FOREACH(trace, &plugin.mem_traces, entry) {
+        g_ptr_array_add(traces, trace);
+    }
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    for (guint i = 0; i < traces->len; i++) {
+        plugin_mem_trace_flush(cpu->cpu_index, g_ptr_array_index(traces, i));
+    }
+}
+
 void qemu_plugin_vcpu_exit_hook(CPUState *cpu)
 {
     bool success;
 
+    plugin_mem_trace_flush_vcpu(cpu);
     qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_RW_REGS);
     plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_EXIT);
     qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_NO_REGS);
@@ -369,6 +393,10 @@ static enum plugin_dyn_cb_type op_to_cb_type(enum qemu_plugin_op op)
         return PLUGIN_CB_INLINE_ADD_U64;
     case QEMU_PLUGIN_INLINE_STORE_U64:
         return PLUGIN_CB_INLINE_STORE_U64;
+    case QEMU_PLUGIN_INLINE_MIN_U64:
+        return PLUGIN_CB_INLINE_MIN_U64;
+    case QEMU_PLUGIN_INLINE_MAX_U64:
+        return PLUGIN_CB_INLINE_MAX_U64;
     default:
         g_assert_not_reached();
     }
@@ -491,6 +519,17 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+void plugin_register_vcpu_mem_trace(GArray **arr,
+                                    enum qemu_plugin_mem_rw rw,
+                                    struct qemu_plugin_mem_trace *trace)
+{
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+    struct qemu_plugin_mem_trace_cb trace_cb = { .trace = trace,
+                                                 .rw = rw };
+    dyn_cb->type = PLUGIN_CB_MEM_TRACE;
+    dyn_cb->mem_trace = trace_cb;
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -568,6 +607,7 @@ void qemu_plugin_vcpu_idle_cb(CPUState *cpu)
 {
     /* idle and resume cb may be called before init, ignore in this case */
     if (cpu->cpu_index < plugin.num_vcpus) {
+        plugin_mem_trace_flush_vcpu(cpu);
         qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_RW_REGS);
         plugin_vcpu_cb__simple(cpu, QEMU_PLUGIN_EV_VCPU_IDLE);
         qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_NO_REGS);
@@ -665,11 +705,99 @@ void exec_inline_op(enum plugin_dyn_cb_type type,
     case PLUGIN_CB_INLINE_STORE_U64:
         *val = cb->imm;
         break;
+    case PLUGIN_CB_INLINE_MIN_U64:
+        *val = MIN(*val, cb->imm);
+        break;
+    case PLUGIN_CB_INLINE_MAX_U64:
+        *val = MAX(*val, cb->imm);
+        break;
     default:
         g_assert_not_reached();
     }
 }
 
+static struct qemu_plugin_mem_trace_buf *
+plugin_mem_trace_buf(struct qemu_plugin_mem_trace *trace,
+                     unsigned int vcpu_index)
+{
+    GArray *arr = trace->score->data;
+
+    return (void *)(arr->data + vcpu_index * g_array_get_element_size(arr));
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+void plugin_mem_trace_flush(unsigned int vcpu_index, void *opaque)
+{
+    struct qemu_plugin_mem_trace *trace = opaque;
+    struct qemu_plugin_mem_trace_buf *buf =
+        plugin_mem_trace_buf(trace, vcpu_index);
+
+    if (buf->len) {
+        trace->cb(vcpu_index, buf->records, buf->len, trace->userdata);
+        buf->len = 0;
+    }
+}
+
+/* Record an access made from a helper, see qemu_plugin_vcpu_mem_cb. */
+static void plugin_mem_trace_record(struct qemu_plugin_mem_trace *trace,
+                                    unsigned int vcpu_index, uint64_t vaddr,
+                                    uint64_t value_low, uint64_t value_high,
+                                    qemu_plugin_meminfo_t info)
+{
+    struct qemu_plugin_mem_trace_buf *buf =
+        plugin_mem_trace_buf(trace, vcpu_index);
+    MemOp size = get_memop(info) & MO_SIZE;
+
+    if (buf->len >= trace->n_records) {
+        plugin_mem_trace_flush(vcpu_index, trace);
+    }
+    buf->records[buf->len].vaddr = vaddr;
+    buf->records[buf->len].info = info;
+    buf->records[buf->len].value =
+        size < MO_64 ? extract64(value_low, 0, 8 << size) : value_low;
+    buf->records[buf->len].value_high = value_high;
+    if (++buf->len == trace->n_records) {
+        plugin_mem_trace_flush(vcpu_index, trace);
+    }
+}
+
+struct qemu_plugin_mem_trace *
+plugin_mem_trace_new(size_t n_records, qemu_plugin_vcpu_mem_trace_cb_t cb,
+                     void *userdata)
+{
+    struct qemu_plugin_mem_trace *trace;
+
+    g_assert(n_records > 0);
+    trace = g_new0(struct qemu_plugin_mem_trace, 1);
+    trace->score = plugin_scoreboard_new(
+        sizeof(struct qemu_plugin_mem_trace_buf) +
+        n_records * sizeof(qemu_plugin_mem_record));
+    trace->n_records = n_records;
+    trace->cb = cb;
+    trace->userdata = userdata;
+
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_INSERT_HEAD(&plugin.mem_traces, trace, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    return trace;
+}
+
+void plugin_mem_trace_free(struct qemu_plugin_mem_trace *trace)
+{
+    qemu_rec_mutex_lock(&plugin.lock);
+    QLIST_REMOVE(trace, entry);
+    qemu_rec_mutex_unlock(&plugin.lock);
+
+    plugin_scoreboard_free(trace->score);
+    g_free(trace);
+}
+
 QEMU_DISABLE_CFI
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_low,
@@ -704,10 +832,19 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
             break;
         case PLUGIN_CB_INLINE_ADD_U64:
         case PLUGIN_CB_INLINE_STORE_U64:
+        case PLUGIN_CB_INLINE_MIN_U64:
+        case PLUGIN_CB_INLINE_MAX_U64:
             if (rw & cb->inline_insn.rw) {
                 exec_inline_op(cb->type, &cb->inline_insn, cpu->cpu_index);
             }
             break;
+        case PLUGIN_CB_MEM_TRACE:
+            if (rw & cb->mem_trace.rw) {
+                plugin_mem_trace_record(cb->mem_trace.trace, cpu->cpu_index,
+                                        vaddr, value_low, value_high,
+                                        make_plugin_meminfo(oi, rw));
+            }
+            break;
         default:
             g_assert_not_reached();
         }
@@ -805,6 +942,7 @@ static void __attribute__((__constructor__)) plugin_init(void)
     plugin.id_ht = g_hash_table_new(g_int64_hash, g_int64_equal);
     plugin.cpu_ht = g_hash_table_new(g_int_hash, g_int_equal);
     QLIST_INIT(&plugin.scoreboards);
+    QLIST_INIT(&plugin.mem_traces);
     plugin.scoreboard_alloc_size = 16; /* avoid frequent reallocation */
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
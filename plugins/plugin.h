@@ -33,6 +33,7 @@ struct qemu_plugin_state {
      */
     GHashTable *cpu_ht;
     QLIST_HEAD(, qemu_plugin_scoreboard) scoreboards;
+    QLIST_HEAD(, qemu_plugin_mem_trace) mem_traces;
     size_t scoreboard_alloc_size;
     DECLARE_BITMAP(mask, QEMU_PLUGIN_EV_MAX);
     /*
@@ -109,6 +110,16 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
+void plugin_register_vcpu_mem_trace(GArray **arr,
+                                    enum qemu_plugin_mem_rw rw,
+                                    struct qemu_plugin_mem_trace *trace);
+
+struct qemu_plugin_mem_trace *
+plugin_mem_trace_new(size_t n_records, qemu_plugin_vcpu_mem_trace_cb_t cb,
+                     void *userdata);
+
+void plugin_mem_trace_free(struct qemu_plugin_mem_trace *trace);
+
 void exec_inline_op(enum plugin_dyn_cb_type type,
                     struct qemu_plugin_inline_cb *cb,
                     int cpu_index);
@@ -1660,7 +1660,7 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
@@ -4722,9 +4722,11 @@ static void bench_cb(void *opaque, int ret)
             b->offset %= b->image_size - b->bufsize;
         }
         if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_pwritev(b->blk, offset, b->qiov,
+                                  BDRV_REQ_REGISTERED_BUF, bench_cb, b);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, b->qiov,
+                                 BDRV_REQ_REGISTERED_BUF, bench_cb, b);
         }
         if (!acb) {
             error_report("Failed to issue request");
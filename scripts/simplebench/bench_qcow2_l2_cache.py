@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# Compare random 4K read performance of two qemu-img binaries on large qcow2
+# images whose L2 tables all fit in the L2 cache, so that the cost of cache
+# lookups dominates.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+
+import sys
+import os
+import subprocess
+import simplebench
+from results_to_text import results_to_text
+
+
+TiB = 1024 ** 4
+CLUSTER_SIZE = 65536
+L2_CACHE_ENTRY_SIZE = 4096
+
+# qemu-img bench has no random mode, but wraps around at the end of the
+# image: stepping by a large prime number of 4K blocks scatters the requests
+# over the whole image, touching a different L2 slice every time.
+STEP = 4096 * 524287
+
+
+def bench_func(env, case):
+    """ Handle one "cell" of benchmarking table. """
+    return bench_l2_cache(env['qemu_img'], env['image_name'],
+                          case['image_size'], case['count'])
+
+
+def qemu_img_pipe(*args):
+    '''Run qemu-img and return its output'''
+    subp = subprocess.Popen(list(args),
+                            stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    exitcode = subp.wait()
+    if exitcode < 0:
+        sys.stderr.write('qemu-img received signal %i: %s\n'
+                         % (-exitcode, ' '.join(list(args))))
+    return subp.communicate()[0]
+
+
+def bench_l2_cache(qemu_img, image_name, image_size, count):
+    """Benchmark random 4K reads with a fully cached L2
+
+    The function creates a QCOW2 image with preallocated metadata, so that
+    every read goes through an L2 table, and an L2 cache big enough for all
+    of them. Then it runs 'qemu-img bench' with @count scattered 4K reads and
+    returns the total time.
+
+    qemu_img   -- path to qemu_img executable file
+    image_name -- QCOW2 image name to create
+    image_size -- virtual size of the image
+    count      -- number of read requests
+
+    Returns {'seconds': int} on success and {'error': str} on failure.
+    Return value is compatible with simplebench lib.
+    """
+
+    if not os.path.isfile(qemu_img):
+        print(f'File not found: {qemu_img}')
+        sys.exit(1)
+
+    image_dir = os.path.dirname(os.path.abspath(image_name))
+    if not os.path.isdir(image_dir):
+        print(f'Path not found: {image_name}')
+        sys.exit(1)
+
+    l2_cache_size = image_size // CLUSTER_SIZE * 8
+
+    args_create = [qemu_img, 'create', '-f', 'qcow2', '-o',
+                   f'cluster_size={CLUSTER_SIZE},preallocation=metadata',
+                   image_name, str(image_size)]
+
+    args_bench = [qemu_img, 'bench', '-t', 'none', '-d', '32', '-c',
+                  str(count), '-s', '4096', '-S', str(STEP), '--image-opts',
+                  f'driver=qcow2,file.filename={image_name},'
+                  f'l2-cache-size={l2_cache_size},'
+                  f'l2-cache-entry-size={L2_CACHE_ENTRY_SIZE}']
+
+    try:
+        qemu_img_pipe(*args_create)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img create failed: ' + str(e)}
+
+    try:
+        ret = qemu_img_pipe(*args_bench)
+    except OSError as e:
+        os.remove(image_name)
+        return {'error': 'qemu_img bench failed: ' + str(e)}
+
+    os.remove(image_name)
+
+    if 'seconds' in ret:
+        ret_list = ret.split()
+        index = ret_list.index('seconds.')
+        return {'seconds': float(ret_list[index-1])}
+    else:
+        return {'error': 'qemu_img bench failed: ' + ret}
+
+
+if __name__ == '__main__':
+
+    if len(sys.argv) < 4:
+        program = os.path.basename(sys.argv[0])
+        print(f'USAGE: {program} <path to qemu-img binary file> '
+              '<path to another qemu-img to compare performance with> '
+              '<full or relative name for QCOW2 image to create>')
+        exit(1)
+
+    # Test-cases are "rows" in benchmark resulting table, 'id' is a caption
+    # for the row, other fields are handled by bench_func.  With 4K cache
+    # entries, 1 TiB needs 32768 of them and 8 TiB 262144.
+    test_cases = [
+        {
+            'id': f'<{size} TiB>',
+            'image_size': size * TiB,
+            'count': 2000000
+        } for size in (1, 2, 4, 8)
+    ]
+
+    # Test-envs are "columns" in benchmark resulting table, 'id is a caption
+    # for the column, other fields are handled by bench_func.
+    test_envs = [
+        {
+            'id': '<qemu-img binary 1>',
+            'qemu_img': f'{sys.argv[1]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+        {
+            'id': '<qemu-img binary 2>',
+            'qemu_img': f'{sys.argv[2]}',
+            'image_name': f'{sys.argv[3]}'
+        },
+    ]
+
+    result = simplebench.bench(bench_func, test_envs, test_cases, count=3,
+                               initial_run=False)
+    print(results_to_text(result))
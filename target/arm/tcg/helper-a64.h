@@ -23,12 +23,12 @@ DEF_HELPER_2(msr_i_spsel, void, env, i32)
 DEF_HELPER_2(msr_i_daifset, void, env, i32)
 DEF_HELPER_2(msr_i_daifclear, void, env, i32)
 DEF_HELPER_1(msr_set_allint_el1, void, env)
-DEF_HELPER_3(vfp_cmph_a64, i64, f16, f16, fpst)
-DEF_HELPER_3(vfp_cmpeh_a64, i64, f16, f16, fpst)
-DEF_HELPER_3(vfp_cmps_a64, i64, f32, f32, fpst)
-DEF_HELPER_3(vfp_cmpes_a64, i64, f32, f32, fpst)
-DEF_HELPER_3(vfp_cmpd_a64, i64, f64, f64, fpst)
-DEF_HELPER_3(vfp_cmped_a64, i64, f64, f64, fpst)
+DEF_HELPER_FLAGS_3(vfp_cmph_a64, TCG_CALL_NO_RWG, i64, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(vfp_cmpeh_a64, TCG_CALL_NO_RWG, i64, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(vfp_cmps_a64, TCG_CALL_NO_RWG, i64, f32, f32, fpst)
+DEF_HELPER_FLAGS_3(vfp_cmpes_a64, TCG_CALL_NO_RWG, i64, f32, f32, fpst)
+DEF_HELPER_FLAGS_3(vfp_cmpd_a64, TCG_CALL_NO_RWG, i64, f64, f64, fpst)
+DEF_HELPER_FLAGS_3(vfp_cmped_a64, TCG_CALL_NO_RWG, i64, f64, f64, fpst)
 DEF_HELPER_FLAGS_4(simd_tblx, TCG_CALL_NO_RWG, void, ptr, ptr, env, i32)
 DEF_HELPER_FLAGS_3(vfp_mulxs, TCG_CALL_NO_RWG, f32, f32, f32, fpst)
 DEF_HELPER_FLAGS_3(vfp_mulxd, TCG_CALL_NO_RWG, f64, f64, f64, fpst)
@@ -53,32 +53,32 @@ DEF_HELPER_FLAGS_2(frecpx_f16, TCG_CALL_NO_RWG, f16, f16, fpst)
 DEF_HELPER_FLAGS_2(fcvtx_f64_to_f32, TCG_CALL_NO_RWG, f32, f64, fpst)
 DEF_HELPER_FLAGS_3(crc32_64, TCG_CALL_NO_RWG_SE, i64, i64, i64, i32)
 DEF_HELPER_FLAGS_3(crc32c_64, TCG_CALL_NO_RWG_SE, i64, i64, i64, i32)
-DEF_HELPER_3(advsimd_ceq_f16, i32, f16, f16, fpst)
-DEF_HELPER_3(advsimd_cge_f16, i32, f16, f16, fpst)
-DEF_HELPER_3(advsimd_cgt_f16, i32, f16, f16, fpst)
-DEF_HELPER_3(advsimd_acge_f16, i32, f16, f16, fpst)
-DEF_HELPER_3(advsimd_acgt_f16, i32, f16, f16, fpst)
-DEF_HELPER_3(advsimd_mulxh, f16, f16, f16, fpst)
-DEF_HELPER_4(advsimd_muladdh, f16, f16, f16, f16, fpst)
-DEF_HELPER_3(advsimd_add2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_sub2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_mul2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_div2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_max2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_min2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_maxnum2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_minnum2h, i32, i32, i32, fpst)
-DEF_HELPER_3(advsimd_mulx2h, i32, i32, i32, fpst)
-DEF_HELPER_4(advsimd_muladd2h, i32, i32, i32, i32, fpst)
-DEF_HELPER_2(advsimd_rinth_exact, f16, f16, fpst)
-DEF_HELPER_2(advsimd_rinth, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_ceq_f16, TCG_CALL_NO_RWG, i32, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_cge_f16, TCG_CALL_NO_RWG, i32, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_cgt_f16, TCG_CALL_NO_RWG, i32, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_acge_f16, TCG_CALL_NO_RWG, i32, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_acgt_f16, TCG_CALL_NO_RWG, i32, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_mulxh, TCG_CALL_NO_RWG, f16, f16, f16, fpst)
+DEF_HELPER_FLAGS_4(advsimd_muladdh, TCG_CALL_NO_RWG, f16, f16, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(advsimd_add2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_sub2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_mul2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_div2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_max2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_min2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_maxnum2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_minnum2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_3(advsimd_mulx2h, TCG_CALL_NO_RWG, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_4(advsimd_muladd2h, TCG_CALL_NO_RWG, i32, i32, i32, i32, fpst)
+DEF_HELPER_FLAGS_2(advsimd_rinth_exact, TCG_CALL_NO_RWG, f16, f16, fpst)
+DEF_HELPER_FLAGS_2(advsimd_rinth, TCG_CALL_NO_RWG, f16, f16, fpst)
 
-DEF_HELPER_3(vfp_ah_minh, f16, f16, f16, fpst)
-DEF_HELPER_3(vfp_ah_mins, f32, f32, f32, fpst)
-DEF_HELPER_3(vfp_ah_mind, f64, f64, f64, fpst)
-DEF_HELPER_3(vfp_ah_maxh, f16, f16, f16, fpst)
-DEF_HELPER_3(vfp_ah_maxs, f32, f32, f32, fpst)
-DEF_HELPER_3(vfp_ah_maxd, f64, f64, f64, fpst)
+DEF_HELPER_FLAGS_3(vfp_ah_minh, TCG_CALL_NO_RWG, f16, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(vfp_ah_mins, TCG_CALL_NO_RWG, f32, f32, f32, fpst)
+DEF_HELPER_FLAGS_3(vfp_ah_mind, TCG_CALL_NO_RWG, f64, f64, f64, fpst)
+DEF_HELPER_FLAGS_3(vfp_ah_maxh, TCG_CALL_NO_RWG, f16, f16, f16, fpst)
+DEF_HELPER_FLAGS_3(vfp_ah_maxs, TCG_CALL_NO_RWG, f32, f32, f32, fpst)
+DEF_HELPER_FLAGS_3(vfp_ah_maxd, TCG_CALL_NO_RWG, f64, f64, f64, fpst)
 
 DEF_HELPER_FLAGS_2(dc_zva, TCG_CALL_NO_WG, void, env, i64)
 
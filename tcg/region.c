@@ -311,6 +311,34 @@ size_t tcg_nb_tbs(void)
     return nb_tbs;
 }
 
+size_t tcg_nb_regions(void)
+{
+    /* no need for synchronization; set at init time */
+    return region.n;
+}
+
+size_t tcg_nb_regions_used(void)
+{
+    size_t used;
+
+    qemu_mutex_lock(&region.lock);
+    used = region.current;
+    qemu_mutex_unlock(&region.lock);
+    return used;
+}
+
+size_t tcg_region_nb_tbs(size_t region_idx)
+{
+    struct tcg_region_tree *rt = region_trees + region_idx * tree_size;
+    size_t nb_tbs;
+
+    g_assert(region_idx < region.n);
+    qemu_mutex_lock(&rt->lock);
+    nb_tbs = q_tree_nnodes(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+    return nb_tbs;
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -0,0 +1,78 @@
+/*
+ * QEMU out-of-line gvec helper speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/units.h"
+#include "exec/helper-proto-common.h"
+#include "tcg/tcg-gvec-desc.h"
+
+typedef void (*gvec_helper_3)(void *, void *, void *, uint32_t);
+
+typedef struct GVecBench {
+    const char *name;
+    gvec_helper_3 fn;
+} GVecBench;
+
+/* The helpers are only used for lengths where oprsz == maxsz */
+static uint32_t make_desc(uint32_t size)
+{
+    uint32_t desc = deposit32(0, SIMD_MAXSZ_SHIFT, SIMD_MAXSZ_BITS,
+                              size / 8 - 1);
+    return deposit32(desc, SIMD_OPRSZ_SHIFT, SIMD_OPRSZ_BITS, 2);
+}
+
+static void test(const void *opaque)
+{
+    const GVecBench *b = opaque;
+    size_t max = 2 * KiB;
+    void *d = g_malloc0(max);
+    void *x = g_malloc0(max);
+    void *y = g_malloc0(max);
+
+    for (size_t len = 64; len <= max; len *= 2) {
+        uint32_t desc = make_desc(len);
+        double total = 0.0;
+
+        g_test_timer_start();
+        do {
+            b->fn(d, x, y, desc);
+            total += len;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        total /= MiB;
+        g_test_message("%s: %4zu bytes %8.0f MB/sec",
+                       b->name, len, total / g_test_timer_last());
+    }
+
+    g_free(d);
+    g_free(x);
+    g_free(y);
+}
+
+static const GVecBench benchs[] = {
+    { "add8", helper_gvec_add8 },
+    { "add32", helper_gvec_add32 },
+    { "add64", helper_gvec_add64 },
+    { "sub16", helper_gvec_sub16 },
+    { "mul16", helper_gvec_mul16 },
+    { "mul32", helper_gvec_mul32 },
+    { "and", helper_gvec_and },
+    { "xor", helper_gvec_xor },
+    { "andc", helper_gvec_andc },
+};
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    for (int i = 0; i < ARRAY_SIZE(benchs); i++) {
+        g_autofree char *path = g_strdup_printf("/tcg/gvec/%s/speed",
+                                                benchs[i].name);
+        g_test_add_data_func(path, &benchs[i], test);
+    }
+    return g_test_run();
+}
@@ -34,6 +34,8 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_RINT,
+    OP_CVTI,
     OP_MAX_NR,
 };
 
@@ -45,6 +47,8 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_RINT] = "roundToInt",
+    [OP_CVTI] = "toInt64",
     [OP_MAX_NR] = NULL,
 };
 
@@ -270,6 +274,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_RINT:
+                    res.f = rintf(a);
+                    break;
+                case OP_CVTI:
+                    res.u64 = llrintf(a);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -305,6 +315,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_RINT:
+                    res.d = rint(a);
+                    break;
+                case OP_CVTI:
+                    res.u64 = llrint(a);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -340,6 +356,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_RINT:
+                    res.f32 = float32_round_to_int(a, &soft_status);
+                    break;
+                case OP_CVTI:
+                    res.u64 = float32_to_int64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -375,6 +397,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_RINT:
+                    res.f64 = float64_round_to_int(a, &soft_status);
+                    break;
+                case OP_CVTI:
+                    res.u64 = float64_to_int64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -410,6 +438,12 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float128_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_RINT:
+                    res.f128 = float128_round_to_int(a, &soft_status);
+                    break;
+                case OP_CVTI:
+                    res.u64 = float128_to_int64(a, &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -448,6 +482,8 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(rint, OP_RINT, 1)
+GEN_BENCH_ALL_TYPES(cvti, OP_CVTI, 1)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -480,6 +516,8 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(rint, OP_RINT),
+    GEN_BENCH_FUNCS(cvti, OP_CVTI),
 };
 
 #undef GEN_BENCH_FUNCS
@@ -56,6 +56,28 @@ static void test_multifd_postcopy_tcp_zstd(void)
 
     test_precopy_common(&args);
 }
+
+static void *
+migrate_hook_start_precopy_tcp_multifd_delta(QTestState *from,
+                                             QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-zstd-level", 2);
+    migrate_set_parameter_int(to, "multifd-zstd-level", 2);
+
+    return migrate_hook_start_precopy_tcp_multifd_common(from, to, "delta");
+}
+
+static void test_multifd_tcp_delta(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start = {
+            .caps[MIGRATION_CAPABILITY_MULTIFD] = true,
+        },
+        .start_hook = migrate_hook_start_precopy_tcp_multifd_delta,
+    };
+    test_precopy_common(&args);
+}
 #endif /* CONFIG_ZSTD */
 
 #ifdef CONFIG_QATZIP
@@ -202,6 +224,8 @@ void migration_test_add_compression(MigrationTestEnv *env)
         migration_test_add("/migration/multifd+postcopy/tcp/plain/zstd",
                            test_multifd_postcopy_tcp_zstd);
     }
+    migration_test_add("/migration/multifd/tcp/plain/delta",
+                       test_multifd_tcp_delta);
 #endif
 
 #ifdef CONFIG_QATZIP
@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qobject/qjson.h"
+#include "qobject/qlist.h"
 #include "libqtest.h"
 #include "migration/framework.h"
 #include "migration/migration-qmp.h"
@@ -256,6 +257,116 @@ static void test_validate_uri_channels_none_set(void)
     do_test_validate_uri_channel(&args);
 }
 
+static void wait_for_dirty_rate_measured(QTestState *who)
+{
+    int max_try_count = 10000;
+
+    while (max_try_count--) {
+        QDict *rsp = qtest_qmp_assert_success_ref(who,
+                                    "{ 'execute': 'query-dirty-rate' }");
+        bool measured = g_str_equal(qdict_get_str(rsp, "status"), "measured");
+
+        qobject_unref(rsp);
+        if (measured) {
+            return;
+        }
+        usleep(1000);
+    }
+    g_assert_not_reached();
+}
+
+static void test_query_migrate_prediction(void)
+{
+    MigrateStart args = {
+        .only_source = true,
+    };
+    const char *methods[] = {
+        "none", "zlib",
+#ifdef CONFIG_ZSTD
+        "zstd",
+#endif
+    };
+    QTestState *from, *to;
+    QList *configs = qlist_new();
+    const QListEntry *entry;
+    QDict *rsp;
+    QList *ret;
+    int i = 0;
+
+    if (migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    /* Fails until calc-dirty-rate has measured something */
+    rsp = qtest_qmp_assert_failure_ref(from,
+                    "{ 'execute': 'query-migrate-prediction',"
+                    "  'arguments': { 'bandwidth': 1000000000,"
+                    "                 'configs': [ {} ] } }");
+    qobject_unref(rsp);
+
+    qtest_qmp_assert_success(from,
+                             "{ 'execute': 'calc-dirty-rate',"
+                             "  'arguments': { 'calc-time': 1 } }");
+    wait_for_dirty_rate_measured(from);
+
+    for (i = 0; i < ARRAY_SIZE(methods); i++) {
+        QDict *config = qdict_new();
+
+        qdict_put_int(config, "multifd-channels", 4);
+        qdict_put_str(config, "multifd-compression", methods[i]);
+        qlist_append(configs, config);
+    }
+
+    rsp = qtest_qmp_assert_success_ref(from,
+                    "{ 'execute': 'query-migrate-prediction',"
+                    "  'arguments': { 'bandwidth': 1000000000,"
+                    "                 'configs': %p } }", configs);
+    ret = qdict_get_qlist(rsp, "return");
+    g_assert_cmpint(qlist_size(ret), ==, ARRAY_SIZE(methods));
+
+    i = 0;
+    QLIST_FOREACH_ENTRY(ret, entry) {
+        QDict *pred = qobject_to(QDict, qlist_entry_obj(entry));
+        QDict *config = qdict_get_qdict(pred, "config");
+        bool converges = qdict_get_bool(pred, "converges");
+
+        g_assert_cmpstr(qdict_get_str(config, "multifd-compression"), ==,
+                        methods[i++]);
+        g_assert_cmpint(qdict_get_int(config, "multifd-channels"), ==, 4);
+        g_assert_cmpint(qdict_get_int(pred, "iterations"), >=, 1);
+        g_assert(qdict_haskey(pred, "transferred"));
+        g_assert(qdict_haskey(pred, "total-time") == converges);
+        g_assert(qdict_haskey(pred, "downtime") == converges);
+    }
+    qobject_unref(rsp);
+
+    /*
+     * Whatever the guest dirties during the first pass fits into an hour
+     * of downtime, as does the postcopy phase, so both finish after one
+     * iteration.
+     */
+    rsp = qtest_qmp_assert_success_ref(from,
+                    "{ 'execute': 'query-migrate-prediction',"
+                    "  'arguments': { 'bandwidth': 1000000000,"
+                    "                 'downtime-limit': 3600000,"
+                    "                 'configs': ["
+                    "                     {}, { 'postcopy-after': 1 } ] } }");
+    ret = qdict_get_qlist(rsp, "return");
+    g_assert_cmpint(qlist_size(ret), ==, 2);
+
+    QLIST_FOREACH_ENTRY(ret, entry) {
+        QDict *pred = qobject_to(QDict, qlist_entry_obj(entry));
+
+        g_assert(qdict_get_bool(pred, "converges"));
+        g_assert_cmpint(qdict_get_int(pred, "iterations"), ==, 1);
+        g_assert_cmpint(qdict_get_int(pred, "total-time"), >=,
+                        qdict_get_int(pred, "downtime"));
+    }
+    qobject_unref(rsp);
+
+    qtest_quit(from);
+}
+
 static void migration_test_add_misc_smoke(MigrationTestEnv *env)
 {
 #ifndef _WIN32
@@ -274,6 +385,8 @@ void migration_test_add_misc(MigrationTestEnv *env)
     }
 
     migration_test_add("/migration/bad_dest", test_baddest);
+    migration_test_add("/migration/query-prediction",
+                       test_query_migrate_prediction);
 
     /*
      * Our CI system has problems with shared memory.
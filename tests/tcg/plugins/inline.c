@@ -20,13 +20,20 @@ typedef struct {
     uint64_t count_insn_inline;
     uint64_t count_mem;
     uint64_t count_mem_inline;
+    uint64_t count_mem_trace;
     uint64_t tb_cond_num_trigger;
     uint64_t tb_cond_track_count;
     uint64_t insn_cond_num_trigger;
     uint64_t insn_cond_track_count;
+    uint64_t insn_max_vaddr;
+    uint64_t insn_max_vaddr_inline;
+    uint64_t insn_min_vaddr;
+    uint64_t insn_min_vaddr_inline;
 } CPUCount;
 
 static const uint64_t cond_trigger_limit = 100;
+/* small enough for the trace buffer to be flushed often */
+static const size_t mem_trace_records = 64;
 
 typedef struct {
     uint64_t data_insn;
@@ -41,10 +48,16 @@ static qemu_plugin_u64 count_insn;
 static qemu_plugin_u64 count_insn_inline;
 static qemu_plugin_u64 count_mem;
 static qemu_plugin_u64 count_mem_inline;
+static qemu_plugin_u64 count_mem_trace;
+static struct qemu_plugin_mem_trace *mem_trace;
 static qemu_plugin_u64 tb_cond_num_trigger;
 static qemu_plugin_u64 tb_cond_track_count;
 static qemu_plugin_u64 insn_cond_num_trigger;
 static qemu_plugin_u64 insn_cond_track_count;
+static qemu_plugin_u64 insn_max_vaddr;
+static qemu_plugin_u64 insn_max_vaddr_inline;
+static qemu_plugin_u64 insn_min_vaddr;
+static qemu_plugin_u64 insn_min_vaddr_inline;
 static struct qemu_plugin_scoreboard *data;
 static qemu_plugin_u64 data_insn;
 static qemu_plugin_u64 data_tb;
@@ -127,6 +140,10 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
     g_autoptr(GString) stats = g_string_new("");
     g_assert(num_cpus == max_cpu_index + 1);
 
+    for (int i = 0; i < num_cpus ; ++i) {
+        qemu_plugin_mem_trace_flush(mem_trace, i);
+    }
+
     for (int i = 0; i < num_cpus ; ++i) {
         const uint64_t tb = qemu_plugin_u64_get(count_tb, i);
         const uint64_t tb_inline = qemu_plugin_u64_get(count_tb_inline, i);
@@ -134,6 +151,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
         const uint64_t insn_inline = qemu_plugin_u64_get(count_insn_inline, i);
         const uint64_t mem = qemu_plugin_u64_get(count_mem, i);
         const uint64_t mem_inline = qemu_plugin_u64_get(count_mem_inline, i);
+        const uint64_t mem_traced = qemu_plugin_u64_get(count_mem_trace, i);
         const uint64_t tb_cond_trigger =
             qemu_plugin_u64_get(tb_cond_num_trigger, i);
         const uint64_t tb_cond_left =
@@ -142,6 +160,12 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
             qemu_plugin_u64_get(insn_cond_num_trigger, i);
         const uint64_t insn_cond_left =
             qemu_plugin_u64_get(insn_cond_track_count, i);
+        const uint64_t max_vaddr = qemu_plugin_u64_get(insn_max_vaddr, i);
+        const uint64_t max_vaddr_inline =
+            qemu_plugin_u64_get(insn_max_vaddr_inline, i);
+        const uint64_t min_vaddr = qemu_plugin_u64_get(insn_min_vaddr, i);
+        const uint64_t min_vaddr_inline =
+            qemu_plugin_u64_get(insn_min_vaddr_inline, i);
         g_string_printf(stats, "cpu %d: tb (%" PRIu64 ", %" PRIu64
                         ", %" PRIu64 " * %" PRIu64 " + %" PRIu64
                         ") | "
@@ -160,16 +184,22 @@ static void plugin_exit(qemu_plugin_id_t id, void *udata)
         g_assert(tb == tb_inline);
         g_assert(insn == insn_inline);
         g_assert(mem == mem_inline);
+        g_assert(mem == mem_traced);
         g_assert(tb_cond_trigger == tb / cond_trigger_limit);
         g_assert(tb_cond_left == tb % cond_trigger_limit);
         g_assert(insn_cond_trigger == insn / cond_trigger_limit);
         g_assert(insn_cond_left == insn % cond_trigger_limit);
+        g_assert(max_vaddr == max_vaddr_inline);
+        g_assert(min_vaddr == min_vaddr_inline);
+        /* The MIN entry keeps its UINT64_MAX seed on idle vCPUs */
+        g_assert(insn == 0 || min_vaddr <= max_vaddr);
     }
 
     stats_tb();
     stats_insn();
     stats_mem();
 
+    qemu_plugin_mem_trace_free(mem_trace);
     qemu_plugin_scoreboard_free(counts);
     qemu_plugin_scoreboard_free(data);
 }
@@ -211,6 +241,31 @@ static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
     g_mutex_unlock(&insn_lock);
 }
 
+static void vcpu_insn_max_vaddr(unsigned int cpu_index, void *udata)
+{
+    const uint64_t vaddr = (uintptr_t) udata;
+
+    if (vaddr > qemu_plugin_u64_get(insn_max_vaddr, cpu_index)) {
+        qemu_plugin_u64_set(insn_max_vaddr, cpu_index, vaddr);
+    }
+}
+
+static void vcpu_insn_min_vaddr(unsigned int cpu_index, void *udata)
+{
+    const uint64_t vaddr = (uintptr_t) udata;
+
+    if (vaddr < qemu_plugin_u64_get(insn_min_vaddr, cpu_index)) {
+        qemu_plugin_u64_set(insn_min_vaddr, cpu_index, vaddr);
+    }
+}
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int cpu_index)
+{
+    /* A minimum needs a seed that any value replaces */
+    qemu_plugin_u64_set(insn_min_vaddr, cpu_index, UINT64_MAX);
+    qemu_plugin_u64_set(insn_min_vaddr_inline, cpu_index, UINT64_MAX);
+}
+
 static void vcpu_mem_access(unsigned int cpu_index,
                             qemu_plugin_meminfo_t info,
                             uint64_t vaddr,
@@ -223,6 +278,20 @@ static void vcpu_mem_access(unsigned int cpu_index,
     g_mutex_unlock(&mem_lock);
 }
 
+static void vcpu_mem_trace(unsigned int cpu_index,
+                           const qemu_plugin_mem_record *records,
+                           size_t n_records, void *udata)
+{
+    g_assert(n_records > 0 && n_records <= mem_trace_records);
+    for (size_t i = 0; i < n_records; i++) {
+        unsigned int shift = qemu_plugin_mem_size_shift(records[i].info);
+
+        /* Values of narrow accesses are zero-extended */
+        g_assert(shift >= 3 || records[i].value >> (8 << shift) == 0);
+    }
+    qemu_plugin_u64_add(count_mem_trace, cpu_index, n_records);
+}
+
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     void *tb_store = tb;
@@ -259,6 +328,19 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             QEMU_PLUGIN_COND_EQ, insn_cond_track_count, cond_trigger_limit,
             insn_store);
 
+        qemu_plugin_register_vcpu_insn_exec_cb(
+            insn, vcpu_insn_max_vaddr, QEMU_PLUGIN_CB_NO_REGS,
+            (void *)(uintptr_t) qemu_plugin_insn_vaddr(insn));
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_MAX_U64, insn_max_vaddr_inline,
+            qemu_plugin_insn_vaddr(insn));
+        qemu_plugin_register_vcpu_insn_exec_cb(
+            insn, vcpu_insn_min_vaddr, QEMU_PLUGIN_CB_NO_REGS,
+            (void *)(uintptr_t) qemu_plugin_insn_vaddr(insn));
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_MIN_U64, insn_min_vaddr_inline,
+            qemu_plugin_insn_vaddr(insn));
+
         qemu_plugin_register_vcpu_mem_inline_per_vcpu(
             insn, QEMU_PLUGIN_MEM_RW,
             QEMU_PLUGIN_INLINE_STORE_U64,
@@ -270,6 +352,8 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
             insn, QEMU_PLUGIN_MEM_RW,
             QEMU_PLUGIN_INLINE_ADD_U64,
             count_mem_inline, 1);
+        qemu_plugin_register_vcpu_mem_trace(insn, QEMU_PLUGIN_MEM_RW,
+                                            mem_trace);
     }
 }
 
@@ -290,6 +374,10 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         counts, CPUCount, count_insn_inline);
     count_mem_inline = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, count_mem_inline);
+    count_mem_trace = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, count_mem_trace);
+    mem_trace = qemu_plugin_mem_trace_new(mem_trace_records,
+                                          vcpu_mem_trace, NULL);
     tb_cond_num_trigger = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, tb_cond_num_trigger);
     tb_cond_track_count = qemu_plugin_scoreboard_u64_in_struct(
@@ -298,11 +386,20 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         counts, CPUCount, insn_cond_num_trigger);
     insn_cond_track_count = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, insn_cond_track_count);
+    insn_max_vaddr = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_max_vaddr);
+    insn_max_vaddr_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_max_vaddr_inline);
+    insn_min_vaddr = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_min_vaddr);
+    insn_min_vaddr_inline = qemu_plugin_scoreboard_u64_in_struct(
+        counts, CPUCount, insn_min_vaddr_inline);
     data = qemu_plugin_scoreboard_new(sizeof(CPUData));
     data_insn = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_insn);
     data_tb = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_tb);
     data_mem = qemu_plugin_scoreboard_u64_in_struct(data, CPUData, data_mem);
 
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
@@ -46,6 +46,7 @@
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qapi/error.h"
+#include "qemu/bitmap.h"
 #include "qemu/defer-call.h"
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
@@ -53,6 +54,9 @@
 
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
+    FDMON_IO_URING_CMD_ENTRIES = 128, /* sq/cq ring size for passthrough */
+    FDMON_IO_URING_FIXED_FILES = 256,  /* registered file table size */
+    FDMON_IO_URING_FIXED_BUFS  = 4096, /* registered buffer table size */
 
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING            = (1 << 0),
@@ -102,6 +106,27 @@ static struct io_uring_sqe *get_sqe(AioContext *ctx)
     return sqe;
 }
 
+/* Like get_sqe(), for the ring of IORING_OP_URING_CMD commands */
+static struct io_uring_sqe *get_cmd_sqe(AioContext *ctx)
+{
+    struct io_uring *ring = ctx->io_uring_cmd_ring;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    int ret;
+
+    if (likely(sqe)) {
+        return sqe;
+    }
+
+    do {
+        ret = io_uring_submit(ring);
+    } while (ret == -EINTR);
+
+    assert(ret > 1);
+    sqe = io_uring_get_sqe(ring);
+    assert(sqe);
+    return sqe;
+}
+
 /* Atomically enqueue an AioHandler for sq ring submission */
 static void enqueue(AioHandlerSList *head, AioHandler *node, unsigned flags)
 {
@@ -201,6 +226,18 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     io_uring_sqe_set_data(sqe, &node->internal_cqe_handler);
 }
 
+/*
+ * The ring of IORING_OP_URING_CMD commands is reaped together with
+ * fdmon_io_uring, this wakes up fdmon_io_uring_wait() when it has cqes.
+ */
+static void add_cmd_ring_poll_sqe(AioContext *ctx)
+{
+    struct io_uring_sqe *sqe = get_sqe(ctx);
+
+    io_uring_prep_poll_add(sqe, ctx->io_uring_cmd_ring->ring_fd, POLLIN);
+    io_uring_sqe_set_data(sqe, &ctx->io_uring_cmd_poll);
+}
+
 static void add_poll_remove_sqe(AioContext *ctx, AioHandler *node)
 {
     struct io_uring_sqe *sqe = get_sqe(ctx);
@@ -286,6 +323,12 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    /* The cqes themselves are reaped by process_cmd_cq_ring() */
+    if (cqe_handler == &ctx->io_uring_cmd_poll) {
+        add_cmd_ring_poll_sqe(ctx);
+        return false;
+    }
+
     /*
      * Special handling for AioHandler cqes. They need ready_list and have a
      * return value.
@@ -303,6 +346,41 @@ static bool process_cqe(AioContext *ctx,
     return false;
 }
 
+/* Cqes of IORING_OP_URING_CMD commands all belong to ordinary handlers */
+static void process_cmd_cq_ring(AioContext *ctx)
+{
+    struct io_uring *ring = ctx->io_uring_cmd_ring;
+    struct io_uring_cqe *cqe;
+    unsigned num_cqes = 0;
+    unsigned head;
+
+#ifdef HAVE_IO_URING_CQ_HAS_OVERFLOW
+    if (io_uring_cq_has_overflow(ring)) {
+        io_uring_get_events(ring);
+    }
+#endif
+
+    io_uring_for_each_cqe(ring, head, cqe) {
+        CqeHandler *cqe_handler = io_uring_cqe_get_data(cqe);
+
+        /* Only the first 16 bytes, like in the other ring */
+        cqe_handler->cqe = *cqe;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        num_cqes++;
+    }
+
+    io_uring_cq_advance(ring, num_cqes);
+}
+
+static void submit_cmd_ring(AioContext *ctx)
+{
+    if (ctx->io_uring_cmd_ring && io_uring_sq_ready(ctx->io_uring_cmd_ring)) {
+        while (io_uring_submit(ctx->io_uring_cmd_ring) == -EINTR) {
+            /* Keep trying if syscall was interrupted */
+        }
+    }
+}
+
 static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
 {
     struct io_uring *ring = &ctx->fdmon_io_uring;
@@ -327,6 +405,11 @@ static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
     }
 
     io_uring_cq_advance(ring, num_cqes);
+
+    /* Don't wait for the poll cqe when polling in userspace */
+    if (ctx->io_uring_cmd_ring) {
+        process_cmd_cq_ring(ctx);
+    }
     return num_ready;
 }
 
@@ -334,6 +417,7 @@ static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
 static void fdmon_io_uring_gsource_prepare(AioContext *ctx)
 {
     fill_sq_ring(ctx);
+    submit_cmd_ring(ctx);
     if (io_uring_sq_ready(&ctx->fdmon_io_uring)) {
         while (io_uring_submit(&ctx->fdmon_io_uring) == -EINTR) {
             /* Keep trying if syscall was interrupted */
@@ -404,6 +488,7 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     }
 
     fill_sq_ring(ctx);
+    submit_cmd_ring(ctx);
 
     /*
      * Loop to handle signals in both cases:
@@ -433,6 +518,12 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
+    if (ctx->io_uring_cmd_ring &&
+        (io_uring_cq_ready(ctx->io_uring_cmd_ring) ||
+         io_uring_sq_ready(ctx->io_uring_cmd_ring))) {
+        return true;
+    }
+
     /* Do we need to process AioHandlers for io_uring changes? */
     if (!QSLIST_EMPTY_RCU(&ctx->submit_list)) {
         return true;
@@ -452,11 +543,169 @@ static const FDMonOps fdmon_io_uring_ops = {
     .add_sqe = fdmon_io_uring_add_sqe,
 };
 
+/*
+ * The registered file and buffer tables are created empty at setup time and
+ * then updated slot by slot.  Updates are plain io_uring_register(2) calls
+ * that the kernel serializes against submission, so they can be made from
+ * any thread; the BQL protects the slot bitmaps.
+ */
+int aio_register_fixed_file(AioContext *ctx, int fd)
+{
+    unsigned long index;
+    int ret;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops || !ctx->io_uring_fixed_files) {
+        return -ENOTSUP;
+    }
+
+    index = find_first_zero_bit(ctx->io_uring_fixed_files,
+                                FDMON_IO_URING_FIXED_FILES);
+    if (index >= FDMON_IO_URING_FIXED_FILES) {
+        return -ENOSPC;
+    }
+
+    ret = io_uring_register_files_update(&ctx->fdmon_io_uring, index, &fd, 1);
+    if (ret < 0) {
+        return ret;
+    }
+
+    set_bit(index, ctx->io_uring_fixed_files);
+    return index;
+}
+
+void aio_unregister_fixed_file(AioContext *ctx, int index)
+{
+    int fd = -1;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        return; /* the io_uring is gone, and its registrations with it */
+    }
+
+    io_uring_register_files_update(&ctx->fdmon_io_uring, index, &fd, 1);
+    clear_bit(index, ctx->io_uring_fixed_files);
+}
+
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+int aio_register_fixed_bufs(AioContext *ctx, const struct iovec *iov,
+                            unsigned iovcnt)
+{
+    unsigned long index;
+    int ret;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops || !ctx->io_uring_fixed_bufs) {
+        return -ENOTSUP;
+    }
+
+    index = bitmap_find_next_zero_area(ctx->io_uring_fixed_bufs,
+                                       FDMON_IO_URING_FIXED_BUFS, 0,
+                                       iovcnt, 0);
+    if (index >= FDMON_IO_URING_FIXED_BUFS) {
+        return -ENOSPC;
+    }
+
+    ret = io_uring_register_buffers_update_tag(&ctx->fdmon_io_uring, index,
+                                               iov, NULL, iovcnt);
+    if (ret < 0) {
+        return ret;
+    }
+
+    bitmap_set(ctx->io_uring_fixed_bufs, index, iovcnt);
+    return index;
+}
+
+void aio_unregister_fixed_bufs(AioContext *ctx, int index, unsigned iovcnt)
+{
+    g_autofree struct iovec *iov = NULL;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        return;
+    }
+
+    /* Empty iovecs turn the slots back into sparse ones */
+    iov = g_new0(struct iovec, iovcnt);
+    io_uring_register_buffers_update_tag(&ctx->fdmon_io_uring, index,
+                                         iov, NULL, iovcnt);
+    bitmap_clear(ctx->io_uring_fixed_bufs, index, iovcnt);
+}
+#else
+int aio_register_fixed_bufs(AioContext *ctx, const struct iovec *iov,
+                            unsigned iovcnt)
+{
+    return -ENOTSUP;
+}
+
+void aio_unregister_fixed_bufs(AioContext *ctx, int index, unsigned iovcnt)
+{
+}
+#endif /* HAVE_IO_URING_REGISTER_SPARSE */
+
+/* Create the ring of IORING_OP_URING_CMD commands if it doesn't exist yet */
+static int fdmon_io_uring_cmd_setup(AioContext *ctx)
+{
+#ifdef HAVE_IO_URING_SQE128
+    struct io_uring *ring;
+    int ret;
+
+    if (ctx->io_uring_cmd_ring) {
+        return 0;
+    }
+
+    ring = g_new0(struct io_uring, 1);
+    ret = io_uring_queue_init(FDMON_IO_URING_CMD_ENTRIES, ring,
+                              IORING_SETUP_SQE128 | IORING_SETUP_CQE32);
+    if (ret < 0) {
+        g_free(ring);
+        return ret;
+    }
+
+    ctx->io_uring_cmd_ring = ring;
+    add_cmd_ring_poll_sqe(ctx);
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+bool aio_has_io_uring_cmd(void)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    return ctx->fdmon_ops == &fdmon_io_uring_ops &&
+           fdmon_io_uring_cmd_setup(ctx) == 0;
+}
+
+void aio_add_sqe_cmd(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
+                     void *opaque, CqeHandler *cqe_handler)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    ret = fdmon_io_uring_cmd_setup(ctx);
+    if (ret < 0) {
+        /* Fail the request from the next fdmon_io_uring_dispatch() */
+        cqe_handler->cqe = (struct io_uring_cqe) { .res = ret };
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        aio_notify(ctx);
+        return;
+    }
+
+    sqe = get_cmd_sqe(ctx);
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, cqe_handler);
+
+    trace_fdmon_io_uring_add_sqe(ctx, opaque, sqe->opcode, sqe->fd, sqe->off,
+                                 cqe_handler);
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
 {
     int ret;
 
     ctx->io_uring_fd_tag = NULL;
+    ctx->io_uring_fixed_files = NULL;
+    ctx->io_uring_fixed_bufs = NULL;
+    ctx->io_uring_cmd_ring = NULL;
 
     ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
     if (ret != 0) {
@@ -464,6 +713,18 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
         return false;
     }
 
+#ifdef HAVE_IO_URING_REGISTER_SPARSE
+    /* Registered files and buffers are optional, older kernels lack them */
+    if (io_uring_register_files_sparse(&ctx->fdmon_io_uring,
+                                       FDMON_IO_URING_FIXED_FILES) == 0) {
+        ctx->io_uring_fixed_files = bitmap_new(FDMON_IO_URING_FIXED_FILES);
+    }
+    if (io_uring_register_buffers_sparse(&ctx->fdmon_io_uring,
+                                         FDMON_IO_URING_FIXED_BUFS) == 0) {
+        ctx->io_uring_fixed_bufs = bitmap_new(FDMON_IO_URING_FIXED_BUFS);
+    }
+#endif
+
     QSLIST_INIT(&ctx->submit_list);
     QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
@@ -480,7 +741,16 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         return;
     }
 
+    if (ctx->io_uring_cmd_ring) {
+        io_uring_queue_exit(ctx->io_uring_cmd_ring);
+        g_free(ctx->io_uring_cmd_ring);
+        ctx->io_uring_cmd_ring = NULL;
+    }
     io_uring_queue_exit(&ctx->fdmon_io_uring);
+    g_free(ctx->io_uring_fixed_files);
+    ctx->io_uring_fixed_files = NULL;
+    g_free(ctx->io_uring_fixed_bufs);
+    ctx->io_uring_fixed_bufs = NULL;
 
     /* Move handlers due to be removed onto the deleted list */
     while ((node = QSLIST_FIRST_RCU(&ctx->submit_list))) {